@@ -24,6 +24,22 @@ if ("${CONFIG_FROGFS_USE_ZLIB}" STREQUAL "y")
     list(APPEND libfrogfs_SRC ${frogfs_DIR}/src/decomp_zlib.c)
 endif()
 
+if ("${CONFIG_FROGFS_USE_ZSTD}" STREQUAL "y")
+    list(APPEND libfrogfs_SRC ${frogfs_DIR}/src/decomp_zstd.c)
+endif()
+
+if ("${CONFIG_FROGFS_USE_LZ4}" STREQUAL "y")
+    list(APPEND libfrogfs_SRC ${frogfs_DIR}/src/decomp_lz4.c)
+endif()
+
+if ("${CONFIG_FROGFS_USE_MINIZ}" STREQUAL "y" OR
+        "${CONFIG_FROGFS_USE_ZLIB}" STREQUAL "y")
+    list(APPEND libfrogfs_SRC ${frogfs_DIR}/src/decomp_block.c)
+    if ("${CONFIG_FROGFS_USE_LIBDEFLATE}" STREQUAL "y")
+        list(APPEND libfrogfs_SRC ${frogfs_DIR}/src/decomp_libdeflate.c)
+    endif()
+endif()
+
 if(ESP_PLATFORM)
     list(APPEND libfrogfs_SRC
         ${frogfs_DIR}/src/vfs.c
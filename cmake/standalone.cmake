@@ -12,12 +12,37 @@ PUBLIC
     ${libfrogfs_INC}
 )
 
+if("${CONFIG_FROGFS_USE_PTHREAD}" STREQUAL "y")
+find_package(Threads REQUIRED)
+target_link_libraries(frogfs
+    Threads::Threads
+)
+endif()
+
 if("${CONFIG_FROGFS_USE_ZLIB}" STREQUAL "y")
 target_link_libraries(frogfs
     z
 )
 endif()
 
+if("${CONFIG_FROGFS_USE_LIBDEFLATE}" STREQUAL "y")
+target_link_libraries(frogfs
+    deflate
+)
+endif()
+
+if("${CONFIG_FROGFS_USE_ZSTD}" STREQUAL "y")
+target_link_libraries(frogfs
+    zstd
+)
+endif()
+
+if("${CONFIG_FROGFS_USE_LZ4}" STREQUAL "y")
+target_link_libraries(frogfs
+    lz4
+)
+endif()
+
 get_cmake_property(_vars VARIABLES)
 list(SORT _vars)
 foreach(_var ${_vars})
@@ -8,6 +8,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -33,7 +34,7 @@ extern "C" {
 /**
  * \brief       Minor version this source distribution supports
  */
-#define FROGFS_VER_MINOR 0
+#define FROGFS_VER_MINOR 1
 
 /**
  * \brief       Flag for \a frogfs_open to open any file as raw. Useful to
@@ -41,6 +42,14 @@ extern "C" {
  */
 #define FROGFS_OPEN_RAW (1 << 0)
 
+/**
+ * \brief       Flag for \a frogfs_open for files that will be read whole
+ *              with \a frogfs_read_all. Decompressors skip allocating their
+ *              streaming buffers until a partial read needs them, and
+ *              sequential reads from the start fill the content cache.
+ */
+#define FROGFS_OPEN_WHOLE (1 << 1)
+
 /**
  * \brief       Enum of frogfs entry types
  */
@@ -57,6 +66,10 @@ typedef enum frogfs_comp_algo_t {
     FROGFS_COMP_ALGO_ZLIB,
     FROGFS_COMP_ALGO_HEATSHRINK,
     FROGFS_COMP_ALGO_GZIP,
+    FROGFS_COMP_ALGO_BLOCK,
+    FROGFS_COMP_ALGO_ZSTD,
+    FROGFS_COMP_ALGO_LZ4,
+    FROGFS_COMP_ALGO_HEATSHRINK_CKPT,
 } frogfs_comp_algo_t;
 
 /**
@@ -68,8 +81,40 @@ typedef struct frogfs_config_t {
     const char *part_label; /**< name of a partition to use as an frogfs
                 filesystem. \a addr should be \a NULL if used */
 #endif
+    size_t lookup_cache_len; /**< number of path lookup cache slots, rounded
+                up to a power of two, or 0 to disable */
+    size_t fh_pool_len; /**< number of preallocated file handles that
+                \a frogfs_open uses before falling back to the heap */
+    size_t decomp_pool_len; /**< maximum number of decompressor contexts,
+                which are kept and reused across opens, or 0 to allocate one
+                per open without a limit */
+    size_t content_cache_sz; /**< byte budget for keeping decompressed
+                copies of recently read files, or 0 to disable */
+    size_t worker_threads; /**< number of threads decoding block compressed
+                files ahead of the reader, or 0 to decode on read. Ignored
+                without \a CONFIG_FROGFS_USE_PTHREAD */
+    bool verify_crc; /**< check the image against its crc32 footer, split
+                across the worker threads, and fail if it does not match */
 } frogfs_config_t;
 
+/**
+ * \brief       Path lookup cache statistics
+ */
+typedef struct frogfs_lookup_stats_t {
+    size_t hits; /**< lookups answered by the cache */
+    size_t misses; /**< lookups that searched the hash table */
+} frogfs_lookup_stats_t;
+
+/**
+ * \brief       Decompressed content cache statistics
+ */
+typedef struct frogfs_content_stats_t {
+    size_t hits; /**< opens served from the cache */
+    size_t misses; /**< opens of compressed files not in the cache */
+    size_t evictions; /**< files evicted to stay within budget */
+    size_t bytes; /**< bytes currently cached */
+} frogfs_content_stats_t;
+
 /**
  * \brief       A frogfs filesystem handle
  */
@@ -110,6 +155,15 @@ typedef struct frogfs_fh_t {
 } frogfs_fh_t;
 #endif
 
+/**
+ * \brief       Caller provided storage for a file handle, see
+ *              \a frogfs_open_into
+ */
+typedef union frogfs_fh_storage_t {
+    void *_align[16];
+    uint64_t _align64;
+} frogfs_fh_storage_t;
+
 /**
  * \brief      Initialize and return a \a frogfs_fs_t instance
  * \param[in]  config   frogfs configuration
@@ -123,6 +177,24 @@ frogfs_fs_t *frogfs_init(const frogfs_config_t *conf);
  */
 void frogfs_deinit(frogfs_fs_t *fs);
 
+/**
+ * \brief       Get path lookup cache statistics
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[out]  stats   \a frogfs_lookup_stats_t structure, zeroed if the
+ *                      cache is disabled
+ */
+void frogfs_get_lookup_stats(const frogfs_fs_t *fs,
+        frogfs_lookup_stats_t *stats);
+
+/**
+ * \brief       Get decompressed content cache statistics
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[out]  stats   \a frogfs_content_stats_t structure, zeroed if the
+ *                      cache is disabled
+ */
+void frogfs_get_content_stats(const frogfs_fs_t *fs,
+        frogfs_content_stats_t *stats);
+
 /**
  * \brief       Get frogfs entry for path
  * \param[in]   fs      \a frogfs_fs_t pointer
@@ -133,6 +205,70 @@ void frogfs_deinit(frogfs_fs_t *fs);
 const frogfs_entry_t *frogfs_get_entry(const frogfs_fs_t *fs,
         const char *path);
 
+/**
+ * \brief       Get frogfs entry for a length delimited path
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   path    path, does not need to be NUL terminated
+ * \param[in]   len     length of path
+ * \return              \a frogfs_entry_t pointer or \a NULL if path was not
+ *                      found
+ */
+const frogfs_entry_t *frogfs_get_entry_n(const frogfs_fs_t *fs,
+        const char *path, size_t len);
+
+/**
+ * \brief       Compute the lookup hash of a path for a filesystem
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   path    path, does not need to be NUL terminated
+ * \param[in]   len     length of path
+ * \return              hash for use with \a frogfs_get_entry_hashed, only
+ *                      valid for this filesystem image
+ */
+uint32_t frogfs_hash_path(const frogfs_fs_t *fs, const char *path, size_t len);
+
+/**
+ * \brief       Get frogfs entry for a path using a precomputed hash
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   hash    hash from \a frogfs_hash_path
+ * \param[in]   path    path, does not need to be NUL terminated
+ * \param[in]   len     length of path
+ * \return              \a frogfs_entry_t pointer or \a NULL if path was not
+ *                      found
+ */
+const frogfs_entry_t *frogfs_get_entry_hashed(const frogfs_fs_t *fs,
+        uint32_t hash, const char *path, size_t len);
+
+/**
+ * \brief       Get frogfs entries for a batch of paths
+ *
+ * Hashes all paths up front, then searches the hash table in hash order with
+ * prefetching, which is faster than calling \a frogfs_get_entry in a loop.
+ * Paths in the lookup cache skip the search, and found paths are added to
+ * it.
+ *
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   paths   array of path strings
+ * \param[in]   n       number of paths
+ * \param[out]  entries array of \a n entry pointers, set to \a NULL for
+ *                      paths that were not found
+ * \return              number of paths found
+ */
+size_t frogfs_get_entries(const frogfs_fs_t *fs, const char *const paths[],
+        size_t n, const frogfs_entry_t *entries[]);
+
+/**
+ * \brief       Get frogfs entry for a path relative to a directory entry
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   dir     directory \a frogfs_entry_t pointer or \a NULL for the
+ *                      root directory
+ * \param[in]   path    relative path, does not need to be NUL terminated
+ * \param[in]   len     length of path
+ * \return              \a frogfs_entry_t pointer or \a NULL if path was not
+ *                      found
+ */
+const frogfs_entry_t *frogfs_get_entry_at(const frogfs_fs_t *fs,
+        const frogfs_entry_t *dir, const char *path, size_t len);
+
 /**
  * \brief       Get name for frogfs entry
  * \param[in]   entry   \a frogfs_entry_t pointer
@@ -140,6 +276,26 @@ const frogfs_entry_t *frogfs_get_entry(const frogfs_fs_t *fs,
  */
 char *frogfs_get_name(const frogfs_entry_t *entry);
 
+/**
+ * \brief       Get name for frogfs entry without copying it
+ * \param[in]   entry   \a frogfs_entry_t pointer
+ * \param[out]  len     length of name
+ * \return              pointer to name within the filesystem image, not NUL
+ *                      terminated
+ */
+const char *frogfs_get_name_view(const frogfs_entry_t *entry, size_t *len);
+
+/**
+ * \brief       Get full path for frogfs entry into a caller provided buffer
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   entry   \a frogfs_entry_t pointer
+ * \param[out]  buf     buffer for the NUL terminated path
+ * \param[in]   buflen  size of buf
+ * \return              length of path or -1 if buf is too small
+ */
+ssize_t frogfs_get_path_into(const frogfs_fs_t *fs,
+        const frogfs_entry_t *entry, char *buf, size_t buflen);
+
 /**
  * \brief       Get full path for frogfs entry
  * \param[in]   fs      \a frogfs_fs_t pointer
@@ -182,6 +338,21 @@ void frogfs_stat(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
 frogfs_fh_t *frogfs_open(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
         unsigned int flags);
 
+/**
+ * \brief       Open a frogfs entry as a file using caller provided storage
+ *              for the handle
+ * \param[in]   fs      \a frogfs_fs_t poitner
+ * \param[in]   entry   \a frogfs_entry_t pointer
+ * \param[in]   flags   open flags
+ * \param[in]   storage storage for the handle, must outlive it
+ * \return              \a frogfs_fh_t pointing into storage or \a NULL on
+ *                      error. It still needs to be closed with
+ *                      \a frogfs_close
+ */
+frogfs_fh_t *frogfs_open_into(const frogfs_fs_t *fs,
+        const frogfs_entry_t *entry, unsigned int flags,
+        frogfs_fh_storage_t *storage);
+
 /**
  * \brief       Close an open file entry
  * \param[in]   f       \a frogfs_fh_t pointer
@@ -205,6 +376,33 @@ int frogfs_is_raw(frogfs_fh_t *fh);
  */
 ssize_t frogfs_read(frogfs_fh_t *fh, void *buf, size_t len);
 
+/**
+ * \brief       Read the rest of an open file entry
+ *
+ * Reading a compressed file whole, from offset 0 into a buffer that holds
+ * all of it, decodes straight into the buffer in one pass. Otherwise this
+ * reads until \a cap bytes or the end of the file.
+ * \param[in]   f       \a frogfs_fh_t pointer
+ * \param[out]  buf     buffer to read into
+ * \param[in]   cap     buffer size
+ * \return              actual number of bytes read or < 0 on error
+ */
+ssize_t frogfs_read_all(frogfs_fh_t *fh, void *buf, size_t cap);
+
+/**
+ * \brief       Read data from an open file entry without copying it
+ *
+ * Only works for uncompressed files and handles opened with
+ * \a FROGFS_OPEN_RAW. The span points into the image and stays valid for
+ * as long as the \a frogfs_fs_t instance.
+ * \param[in]   f       \a frogfs_fh_t pointer
+ * \param[in]   len     maximum number of bytes to read
+ * \param[out]  ptr     set to the start of the span
+ * \return              length of the span, zero if end of file reached or
+ *                      < 0 if the file is not stored raw
+ */
+ssize_t frogfs_read_span(frogfs_fh_t *fh, size_t len, const void **ptr);
+
 /**
  * \brief       Seek to a position within an open file entry
  * \param[in]   f       \a frogfs_fh_t pointer
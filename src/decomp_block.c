@@ -0,0 +1,452 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/**
+ * Block compressed files start with a table of num_blocks + 1 offsets,
+ * relative to the start of the data, followed by the blocks. Each block is
+ * an independent raw deflate stream, or stored as is if it did not compress.
+ * The uncompressed block size is 1 << opts, except for the last block.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "frogfs_priv.h"
+#include "log.h"
+#include "frogfs_format.h"
+#include "frogfs/frogfs.h"
+
+#if CONFIG_FROGFS_USE_MINIZ == 1
+# include "miniz.h"
+#elif CONFIG_FROGFS_USE_ZLIB == 1
+# define ZLIB_CONST
+# include "zlib.h"
+#endif
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+# include <pthread.h>
+#endif
+
+
+#define NO_BLOCK UINT32_MAX
+#define PRIV(f) ((priv_data_t *)(f->decomp_priv))
+
+typedef struct priv_data_t priv_data_t;
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+typedef enum {
+    SLOT_EMPTY,
+    SLOT_PENDING,
+    SLOT_DONE,
+    SLOT_ERROR,
+} slot_state_t;
+
+/* read ahead ring slot, decoded by a worker thread */
+typedef struct {
+    frogfs_job_t job;
+    priv_data_t *priv;
+#if CONFIG_FROGFS_USE_ZLIB == 1 && CONFIG_FROGFS_USE_MINIZ != 1
+    z_stream stream;
+#endif
+    uint8_t *buf;
+    uint32_t block;
+    slot_state_t state;
+} slot_t;
+#endif
+
+struct priv_data_t {
+#if CONFIG_FROGFS_USE_ZLIB == 1 && CONFIG_FROGFS_USE_MINIZ != 1
+    z_stream stream;
+#endif
+    const void *data; /* block offset table */
+    uint8_t shift; /* log2 of block size */
+    size_t real_sz;
+    uint8_t *buf;
+    size_t buf_sz;
+    uint32_t block;
+    size_t pos;
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    /* read ahead, used when the fs has workers */
+    slot_t *ring;
+    size_t ring_len;
+    size_t ring_buf_sz;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+static inline size_t block_sz(const priv_data_t *priv)
+{
+    return (size_t) 1 << priv->shift;
+}
+
+// Returns the uncompressed length of block i.
+static inline size_t block_len(const priv_data_t *priv, uint32_t i)
+{
+    size_t start = (size_t) i << priv->shift;
+    size_t len = priv->real_sz - start;
+    return len < block_sz(priv) ? len : block_sz(priv);
+}
+
+#if CONFIG_FROGFS_USE_ZLIB == 1 && CONFIG_FROGFS_USE_MINIZ != 1
+# define STREAM(x) (&(x)->stream)
+typedef z_stream *stream_t;
+#else
+# define STREAM(x) NULL
+typedef void *stream_t;
+#endif
+
+// Decodes block i into out, which must hold block_len(priv, i) bytes.
+static int decode_block(const priv_data_t *priv, uint32_t i, uint8_t *out,
+        stream_t stream)
+{
+    const uint32_t *offs = priv->data;
+    const uint8_t *in = priv->data + offs[i];
+    size_t in_len = offs[i + 1] - offs[i];
+    size_t out_len = block_len(priv, i);
+
+    if (in_len == out_len) {
+        /* stored */
+        memcpy(out, in, out_len);
+        return 0;
+    }
+
+#if CONFIG_FROGFS_USE_MINIZ == 1
+    (void) stream;
+    if (tinfl_decompress_mem_to_mem(out, out_len, in, in_len, 0) !=
+            out_len) {
+        LOGE("tinfl_decompress_mem_to_mem");
+        return -1;
+    }
+#else
+    inflateReset(stream);
+    stream->next_in = in;
+    stream->avail_in = in_len;
+    stream->next_out = out;
+    stream->avail_out = out_len;
+    if (inflate(stream, Z_FINISH) != Z_STREAM_END ||
+            stream->total_out != out_len) {
+        LOGE("inflate");
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+static void run_slot(frogfs_job_t *job)
+{
+    slot_t *slot = (slot_t *) job;
+    priv_data_t *priv = slot->priv;
+
+    int ret = decode_block(priv, slot->block, slot->buf, STREAM(slot));
+
+    pthread_mutex_lock(&priv->lock);
+    slot->state = ret < 0 ? SLOT_ERROR : SLOT_DONE;
+    pthread_cond_broadcast(&priv->cond);
+    pthread_mutex_unlock(&priv->lock);
+}
+
+// Waits for all in flight read ahead to finish.
+static void drain_ring(priv_data_t *priv)
+{
+    pthread_mutex_lock(&priv->lock);
+    for (size_t i = 0; i < priv->ring_len; i++) {
+        while (priv->ring[i].state == SLOT_PENDING) {
+            pthread_cond_wait(&priv->cond, &priv->lock);
+        }
+        priv->ring[i].state = SLOT_EMPTY;
+    }
+    pthread_mutex_unlock(&priv->lock);
+}
+
+static void free_ring(priv_data_t *priv)
+{
+    drain_ring(priv);
+    for (size_t i = 0; i < priv->ring_len; i++) {
+#if CONFIG_FROGFS_USE_ZLIB == 1 && CONFIG_FROGFS_USE_MINIZ != 1
+        inflateEnd(&priv->ring[i].stream);
+#endif
+        free(priv->ring[i].buf);
+    }
+    free(priv->ring);
+    priv->ring = NULL;
+    priv->ring_len = 0;
+    priv->ring_buf_sz = 0;
+}
+
+static int alloc_ring(priv_data_t *priv, size_t len)
+{
+    priv->ring = calloc(len, sizeof(slot_t));
+    if (priv->ring == NULL) {
+        LOGE("calloc failed");
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        slot_t *slot = &priv->ring[i];
+        slot->job.run = run_slot;
+        slot->priv = priv;
+        slot->block = NO_BLOCK;
+        slot->buf = malloc(block_sz(priv));
+#if CONFIG_FROGFS_USE_ZLIB == 1 && CONFIG_FROGFS_USE_MINIZ != 1
+        if (inflateInit2(&slot->stream, -MAX_WBITS) != Z_OK) {
+            free(slot->buf);
+            slot->buf = NULL;
+        }
+#endif
+        if (slot->buf == NULL) {
+            LOGE("malloc failed");
+            free_ring(priv);
+            return -1;
+        }
+        priv->ring_len++;
+    }
+    priv->ring_buf_sz = block_sz(priv);
+    return 0;
+}
+
+// Queues blocks first to first + ring_len - 1 that are not already in the
+// ring. Call with the lock held.
+static void fill_ring(const frogfs_fh_t *f, priv_data_t *priv, uint32_t first)
+{
+    uint32_t num_blocks = (priv->real_sz + block_sz(priv) - 1) >> priv->shift;
+
+    for (uint32_t i = first; i < num_blocks && i - first < priv->ring_len;
+            i++) {
+        slot_t *slot = &priv->ring[i % priv->ring_len];
+        if (slot->state == SLOT_PENDING ||
+                (slot->block == i && slot->state != SLOT_EMPTY)) {
+            continue;
+        }
+        slot->block = i;
+        slot->state = SLOT_PENDING;
+        frogfs_submit_job(f->fs, &slot->job);
+    }
+}
+
+// Returns the ring slot holding block i once it has been decoded.
+static slot_t *get_slot(const frogfs_fh_t *f, priv_data_t *priv, uint32_t i)
+{
+    slot_t *slot = &priv->ring[i % priv->ring_len];
+
+    pthread_mutex_lock(&priv->lock);
+    if (slot->block != i || slot->state == SLOT_EMPTY) {
+        /* wait for a stale decode still using the slot */
+        while (slot->state == SLOT_PENDING) {
+            pthread_cond_wait(&priv->cond, &priv->lock);
+        }
+        slot->state = SLOT_EMPTY;
+    }
+    fill_ring(f, priv, i);
+    while (slot->state == SLOT_PENDING) {
+        pthread_cond_wait(&priv->cond, &priv->lock);
+    }
+    if (slot->state == SLOT_ERROR) {
+        slot->state = SLOT_EMPTY;
+        slot = NULL;
+    }
+    pthread_mutex_unlock(&priv->lock);
+
+    return slot;
+}
+#endif
+
+static int open_block(frogfs_fh_t *f, unsigned int flags)
+{
+    const frogfs_comp_t *comp = (const frogfs_comp_t *) f->file;
+    priv_data_t *priv = f->decomp_priv;
+
+    (void) flags;
+
+    if (priv == NULL) {
+        priv = calloc(1, sizeof(priv_data_t));
+        if (priv == NULL) {
+            LOGE("calloc failed");
+            return -1;
+        }
+
+#if CONFIG_FROGFS_USE_ZLIB == 1 && CONFIG_FROGFS_USE_MINIZ != 1
+        if (inflateInit2(&priv->stream, -MAX_WBITS) != Z_OK) {
+            LOGE("error allocating zlib stream");
+            free(priv);
+            return -1;
+        }
+#endif
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+        pthread_mutex_init(&priv->lock, NULL);
+        pthread_cond_init(&priv->cond, NULL);
+#endif
+        f->decomp_priv = priv;
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    } else {
+        /* pooled context, read ahead may still be running */
+        drain_ring(priv);
+#endif
+    }
+
+    priv->data = f->data_start;
+    priv->shift = comp->entry.opts;
+    priv->real_sz = comp->real_sz;
+    priv->block = NO_BLOCK;
+    priv->pos = 0;
+
+    if (priv->buf_sz < block_sz(priv)) {
+        /* pooled buffers grow to the largest block size seen */
+        uint8_t *buf = realloc(priv->buf, block_sz(priv));
+        if (buf == NULL) {
+            LOGE("realloc failed");
+            return -1;
+        }
+        priv->buf = buf;
+        priv->buf_sz = block_sz(priv);
+    }
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    size_t workers = frogfs_num_workers(f->fs);
+    if (workers > 0 && priv->real_sz > block_sz(priv)) {
+        if (priv->ring_buf_sz < block_sz(priv) ||
+                priv->ring_len != workers * 2) {
+            free_ring(priv);
+        }
+        if (priv->ring == NULL && alloc_ring(priv, workers * 2) < 0) {
+            return -1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+static void close_block(frogfs_fh_t *f)
+{
+    priv_data_t *priv = f->decomp_priv;
+    if (priv == NULL) {
+        return;
+    }
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    free_ring(priv);
+    pthread_mutex_destroy(&priv->lock);
+    pthread_cond_destroy(&priv->cond);
+#endif
+#if CONFIG_FROGFS_USE_ZLIB == 1 && CONFIG_FROGFS_USE_MINIZ != 1
+    inflateEnd(&priv->stream);
+#endif
+    free(priv->buf);
+    free(priv);
+    f->decomp_priv = NULL;
+}
+
+static ssize_t read_block(frogfs_fh_t *f, void *buf, size_t len)
+{
+    priv_data_t *priv = f->decomp_priv;
+    size_t start_len = len;
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    bool ahead = priv->ring != NULL && priv->real_sz > block_sz(priv);
+#endif
+
+    while (len > 0 && priv->pos < priv->real_sz) {
+        uint32_t i = priv->pos >> priv->shift;
+        size_t offs = priv->pos & (block_sz(priv) - 1);
+        size_t chunk = block_len(priv, i) - offs;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+        if (buf && ahead) {
+            slot_t *slot = get_slot(f, priv, i);
+            if (slot == NULL) {
+                return -1;
+            }
+            memcpy(buf, slot->buf + offs, chunk);
+            goto next;
+        }
+#endif
+
+        if (buf && i != priv->block) {
+            if (offs == 0 && chunk == block_len(priv, i)) {
+                /* whole block requested, decode in place */
+                if (decode_block(priv, i, buf, STREAM(priv)) < 0) {
+                    return -1;
+                }
+                goto next;
+            }
+            if (decode_block(priv, i, priv->buf, STREAM(priv)) < 0) {
+                priv->block = NO_BLOCK;
+                return -1;
+            }
+            priv->block = i;
+        }
+
+        if (buf) {
+            memcpy(buf, priv->buf + offs, chunk);
+        }
+
+next:
+        if (buf) {
+            buf += chunk;
+        }
+        priv->pos += chunk;
+        len -= chunk;
+    }
+
+    return start_len - len;
+}
+
+static ssize_t seek_block(frogfs_fh_t *f, long offset, int mode)
+{
+    priv_data_t *priv = f->decomp_priv;
+    ssize_t new_pos = priv->pos;
+
+    if (mode == SEEK_SET) {
+        if (offset < 0) {
+            return -1;
+        }
+        if (offset > (ssize_t) priv->real_sz) {
+            offset = priv->real_sz;
+        }
+        new_pos = offset;
+    } else if (mode == SEEK_CUR) {
+        if (new_pos + offset < 0) {
+            new_pos = 0;
+        } else if (new_pos + offset > (ssize_t) priv->real_sz) {
+            new_pos = priv->real_sz;
+        } else {
+            new_pos += offset;
+        }
+    } else if (mode == SEEK_END) {
+        if (offset > 0) {
+            return -1;
+        }
+        if (offset < -(ssize_t) priv->real_sz) {
+            offset = -(ssize_t) priv->real_sz;
+        }
+        new_pos = priv->real_sz + offset;
+    } else {
+        return -1;
+    }
+
+    priv->pos = new_pos;
+    return new_pos;
+}
+
+static size_t tell_block(frogfs_fh_t *f)
+{
+    return PRIV(f)->pos;
+}
+
+const frogfs_decomp_funcs_t frogfs_decomp_block = {
+    .open = open_block,
+    .close = close_block,
+    .read = read_block,
+    .seek = seek_block,
+    .tell = tell_block,
+};
@@ -17,43 +17,106 @@
 #include "frogfs/frogfs.h"
 
 
-#define BUFFER_LEN 16
+#define BUFFER_LEN CONFIG_FROGFS_HEATSHRINK_BUFFER_LEN
 #define PRIV(f) ((decomp_priv_t *)(f->decomp_priv))
 
 typedef struct {
     heatshrink_decoder *hsd;
     size_t file_pos;
+    uint8_t opts;
+    uint8_t *scratch; /* one window of discarded output, or NULL */
+    size_t scratch_len;
 } decomp_priv_t;
 
-static int open_heatshrink(frogfs_fh_t *f, unsigned int flags)
-{
-    const frogfs_comp_t *comp = (const frogfs_comp_t *) f->file;
+typedef struct {
+    const uint8_t *in;
+    const uint8_t *end;
+    uint32_t bits;
+    int num_bits;
+} bit_reader_t;
 
-    decomp_priv_t *data = malloc(sizeof(decomp_priv_t));
-    if (data == NULL) {
-        LOGE("malloc failed");
-        return -1;
+// Allocates the streaming decoder for the handle's parameters.
+static int alloc_decoder(frogfs_fh_t *f)
+{
+    decomp_priv_t *data = f->decomp_priv;
+    if (data->hsd != NULL) {
+        return 0;
     }
-    memset(data, 0, sizeof(*data));
 
-    uint8_t args = comp->entry.opts;
-    uint8_t window = args & 0xf;
-    uint8_t lookahead = args >> 4;
+    uint8_t window = data->opts & 0xf;
+    uint8_t lookahead = data->opts >> 4;
 
     data->hsd = heatshrink_decoder_alloc(BUFFER_LEN, window, lookahead);
     if (data->hsd == NULL) {
         LOGE("error allocating heatshrink decoder");
-        free(data);
         return -1;
     }
+    return 0;
+}
+
+// Allocates the scratch buffer that seeks decode discarded output into.
+static int alloc_scratch(frogfs_fh_t *f)
+{
+    decomp_priv_t *data = f->decomp_priv;
+    size_t len = 1 << (data->opts & 0xf);
+
+    if (data->scratch_len < len) {
+        /* pooled contexts keep the largest window seen */
+        free(data->scratch);
+        data->scratch_len = 0;
+        data->scratch = malloc(len);
+        if (data->scratch == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+        data->scratch_len = len;
+    }
+    return 0;
+}
+
+static int open_heatshrink(frogfs_fh_t *f, unsigned int flags)
+{
+    const frogfs_comp_t *comp = (const frogfs_comp_t *) f->file;
+
+    decomp_priv_t *data = f->decomp_priv;
+    if (data != NULL) {
+        /* pooled decoder, reuse it if the parameters match */
+        data->file_pos = 0;
+        if (data->hsd && data->opts == comp->entry.opts) {
+            heatshrink_decoder_reset(data->hsd);
+            return 0;
+        }
+        if (data->hsd) {
+            heatshrink_decoder_free(data->hsd);
+            data->hsd = NULL;
+        }
+    } else {
+        data = malloc(sizeof(decomp_priv_t));
+        if (data == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+        memset(data, 0, sizeof(*data));
+        f->decomp_priv = data;
+    }
+    data->opts = comp->entry.opts;
 
-    f->decomp_priv = data;
+    /* whole file reads do not need the streaming decoder */
+    if (!(flags & FROGFS_OPEN_WHOLE)) {
+        return alloc_decoder(f);
+    }
     return 0;
 }
 
 static void close_heatshrink(frogfs_fh_t *f)
 {
-    heatshrink_decoder_free(PRIV(f)->hsd);
+    if (PRIV(f) == NULL) {
+        return;
+    }
+    if (PRIV(f)->hsd) {
+        heatshrink_decoder_free(PRIV(f)->hsd);
+    }
+    free(PRIV(f)->scratch);
     free(PRIV(f));
     f->decomp_priv = NULL;
 }
@@ -62,6 +125,10 @@ static ssize_t read_heatshrink(frogfs_fh_t *f, void *buf, size_t len)
 {
     size_t rlen, decoded = 0;
 
+    if (alloc_decoder(f) < 0) {
+        return -1;
+    }
+
     while (decoded < len) {
         /* feed data into the decoder */
         size_t remain = f->data_sz - (f->data_ptr - f->data_start);
@@ -104,6 +171,156 @@ static ssize_t read_heatshrink(frogfs_fh_t *f, void *buf, size_t len)
     return len;
 }
 
+// Returns the next count bits of the stream, or -1 if it ran out.
+static inline int get_bits(bit_reader_t *br, int count)
+{
+    while (br->num_bits < count) {
+        if (br->in == br->end) {
+            return -1;
+        }
+        br->bits = (br->bits << 8) | *br->in++;
+        br->num_bits += 8;
+    }
+    br->num_bits -= count;
+    return (br->bits >> br->num_bits) & ((1 << count) - 1);
+}
+
+static ssize_t read_all_heatshrink(frogfs_fh_t *f, void *buf)
+{
+    /* the output buffer is the window, so decode without the ring and
+     * without the sink and poll round trips */
+    bit_reader_t br = {
+        .in = f->data_start,
+        .end = f->data_start + f->data_sz,
+    };
+    int window = PRIV(f)->opts & 0xf;
+    int lookahead = PRIV(f)->opts >> 4;
+    uint8_t *out = buf;
+    size_t pos = 0;
+
+    while (pos < f->real_sz) {
+        int tag = get_bits(&br, 1);
+        if (tag == 1) {
+            int c = get_bits(&br, 8);
+            if (c < 0) {
+                goto err_out;
+            }
+            out[pos++] = c;
+            continue;
+        }
+
+        int index = get_bits(&br, window);
+        int count = get_bits(&br, lookahead);
+        if (tag < 0 || index < 0 || count < 0 ||
+                count + 1 > f->real_sz - pos) {
+            goto err_out;
+        }
+
+        size_t offset = index + 1;
+        for (int i = 0; i <= count; i++, pos++) {
+            /* the decoder window starts out zeroed */
+            out[pos] = offset > pos ? 0 : out[pos - offset];
+        }
+    }
+
+    /* leave the handle at the end, a seek back resets it */
+    f->data_ptr = f->data_start + f->data_sz;
+    PRIV(f)->file_pos = pos;
+    return pos;
+
+err_out:
+    LOGE("heatshrink stream is corrupt");
+    return -1;
+}
+
+// Restarts the decoder at a seek checkpoint by decoding its window.
+static int resume_heatshrink(frogfs_fh_t *f, const frogfs_ckpt_t *ckpt,
+        const frogfs_hs_window_t *window)
+{
+    size_t sunk = 0, discarded = 0;
+    size_t rlen;
+
+    if (alloc_scratch(f) < 0) {
+        return -1;
+    }
+    heatshrink_decoder_reset(PRIV(f)->hsd);
+
+    while (sunk < window->len || discarded < window->num_lits) {
+        if (sunk < window->len) {
+            size_t len = window->len - sunk;
+            HSD_sink_res res = heatshrink_decoder_sink(PRIV(f)->hsd,
+                    (uint8_t *) window->bits + sunk,
+                    len > BUFFER_LEN ? BUFFER_LEN : len, &rlen);
+            if (res < 0) {
+                LOGE("heatshrink_decoder_sink");
+                return -1;
+            }
+            sunk += rlen;
+        }
+
+        /* the replayed literals land in the scratch buffer */
+        size_t len = window->num_lits - discarded;
+        HSD_poll_res res = heatshrink_decoder_poll(PRIV(f)->hsd,
+                PRIV(f)->scratch, len > PRIV(f)->scratch_len ?
+                PRIV(f)->scratch_len : len, &rlen);
+        if (res < 0) {
+            LOGE("heatshrink_decoder_poll");
+            return -1;
+        }
+        discarded += rlen;
+        if (res == HSDR_POLL_EMPTY && sunk == window->len &&
+                discarded < window->num_lits) {
+            LOGE("heatshrink checkpoint is corrupt");
+            return -1;
+        }
+    }
+
+    f->data_ptr = f->data_start + ckpt->in_offs;
+    PRIV(f)->file_pos = ckpt->out_offs;
+    return 0;
+}
+
+static ssize_t skip_heatshrink(frogfs_fh_t *f, size_t len)
+{
+    size_t rlen, done = 0;
+
+    if (alloc_decoder(f) < 0 || alloc_scratch(f) < 0) {
+        return -1;
+    }
+
+    /* poll up to a window at a time into the context's scratch buffer */
+    while (done < len) {
+        size_t remain = f->data_sz - (f->data_ptr - f->data_start);
+        if (remain > 0) {
+            HSD_sink_res res = heatshrink_decoder_sink(PRIV(f)->hsd,
+                    (uint8_t *) f->data_ptr, (remain > BUFFER_LEN) ?
+                    BUFFER_LEN : remain, &rlen);
+            if (res < 0) {
+                LOGE("heatshrink_decoder_sink");
+                return -1;
+            }
+            f->data_ptr += rlen;
+        }
+
+        size_t want = len - done;
+        HSD_poll_res res = heatshrink_decoder_poll(PRIV(f)->hsd,
+                PRIV(f)->scratch, want < PRIV(f)->scratch_len ? want :
+                PRIV(f)->scratch_len, &rlen);
+        if (res < 0) {
+            LOGE("heatshrink_decoder_poll");
+            return -1;
+        }
+        PRIV(f)->file_pos += rlen;
+        done += rlen;
+
+        if (remain == 0 && res == HSDR_POLL_EMPTY) {
+            break;
+        }
+    }
+
+    return done;
+}
+
 static ssize_t seek_heatshrink(frogfs_fh_t *f, long offset, int mode)
 {
     const frogfs_comp_t *comp = (const frogfs_comp_t *) f->file;
@@ -120,7 +337,7 @@ static ssize_t seek_heatshrink(frogfs_fh_t *f, long offset, int mode)
     } else if (mode == SEEK_CUR) {
         if (new_pos + offset < 0) {
             new_pos = 0;
-        } else if (new_pos > comp->real_sz) {
+        } else if (new_pos + offset > (ssize_t) comp->real_sz) {
             new_pos = comp->real_sz;
         } else {
             new_pos += offset;
@@ -130,27 +347,32 @@ static ssize_t seek_heatshrink(frogfs_fh_t *f, long offset, int mode)
             return -1;
         }
         if (offset < -(ssize_t) comp->real_sz) {
-            offset = 0;
+            offset = -(ssize_t) comp->real_sz;
         }
         new_pos = comp->real_sz + offset;
     } else {
         return -1;
     }
 
-    if (new_pos < PRIV(f)->file_pos) {
+    if (alloc_decoder(f) < 0) {
+        return -1;
+    }
+
+    const void *window;
+    const frogfs_ckpt_t *ckpt = frogfs_find_ckpt(f, new_pos, &window);
+    if (ckpt && (new_pos < PRIV(f)->file_pos ||
+            ckpt->out_offs > PRIV(f)->file_pos)) {
+        if (resume_heatshrink(f, ckpt, window) < 0) {
+            return -1;
+        }
+    } else if (new_pos < PRIV(f)->file_pos) {
         f->data_ptr = f->data_start;
         PRIV(f)->file_pos = 0;
         heatshrink_decoder_reset(PRIV(f)->hsd);
     }
 
-    while (new_pos > PRIV(f)->file_pos) {
-        uint8_t buf[BUFFER_LEN];
-        size_t len = new_pos - PRIV(f)->file_pos < BUFFER_LEN ?
-                new_pos - PRIV(f)->file_pos : BUFFER_LEN;
-
-        ssize_t res = frogfs_read(f, buf, len);
-        if (res < 0) {
-            LOGE("frogfs_read");
+    if (new_pos > PRIV(f)->file_pos) {
+        if (skip_heatshrink(f, new_pos - PRIV(f)->file_pos) < 0) {
             return -1;
         }
     }
@@ -169,4 +391,6 @@ const frogfs_decomp_funcs_t frogfs_decomp_heatshrink = {
     .read = read_heatshrink,
     .seek = seek_heatshrink,
     .tell = tell_heatshrink,
+    .read_all = read_all_heatshrink,
+    .skip = skip_heatshrink,
 };
@@ -0,0 +1,65 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "libdeflate.h"
+
+#include "frogfs_priv.h"
+#include "log.h"
+#include "frogfs_format.h"
+#include "frogfs/frogfs.h"
+
+
+int frogfs_inflate_all(frogfs_fh_t *f, void *buf,
+        struct libdeflate_decompressor **d)
+{
+    const uint8_t *p = f->data_start;
+    enum libdeflate_result ret;
+    bool zlib = (p[0] & 0x0f) == 8 && ((p[0] << 8) | p[1]) % 31 == 0;
+
+    if (zlib && (p[1] & 0x20)) {
+        /* preset dictionaries are not supported by libdeflate */
+        return -1;
+    }
+
+    if (*d == NULL) {
+        *d = libdeflate_alloc_decompressor();
+        if (*d == NULL) {
+            LOGE("libdeflate_alloc_decompressor");
+            return -1;
+        }
+    }
+
+    if (p[0] == 0x1f && p[1] == 0x8b) {
+        ret = libdeflate_gzip_decompress(*d, f->data_start, f->data_sz, buf,
+                f->real_sz, NULL);
+    } else if (zlib) {
+        ret = libdeflate_zlib_decompress(*d, f->data_start, f->data_sz, buf,
+                f->real_sz, NULL);
+    } else {
+        /* no header, so a raw deflate stream */
+        ret = libdeflate_deflate_decompress(*d, f->data_start, f->data_sz,
+                buf, f->real_sz, NULL);
+    }
+
+    if (ret != LIBDEFLATE_SUCCESS) {
+        LOGE("libdeflate: %d", ret);
+        return -1;
+    }
+    return 0;
+}
+
+void frogfs_inflate_free(struct libdeflate_decompressor *d)
+{
+    if (d) {
+        libdeflate_free_decompressor(d);
+    }
+}
@@ -0,0 +1,218 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "lz4frame.h"
+
+#include "frogfs_priv.h"
+#include "log.h"
+#include "frogfs_format.h"
+#include "frogfs/frogfs.h"
+
+
+#define PRIV(f) ((decomp_priv_t *)(f->decomp_priv))
+
+typedef struct {
+    LZ4F_dctx *dctx;
+    size_t out_pos;
+    void *scratch; /* one block of skipped output, or NULL */
+    size_t scratch_len;
+} decomp_priv_t;
+
+// Restarts decompression at the start of the frame.
+static void reset_lz4(frogfs_fh_t *f)
+{
+    LZ4F_resetDecompressionContext(PRIV(f)->dctx);
+    PRIV(f)->out_pos = 0;
+    f->data_ptr = f->data_start;
+}
+
+static int open_lz4(frogfs_fh_t *f, unsigned int flags)
+{
+    if (f->decomp_priv == NULL) {
+        decomp_priv_t *data = malloc(sizeof(decomp_priv_t));
+        if (data == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+        data->scratch = NULL;
+        data->scratch_len = 0;
+
+        LZ4F_errorCode_t err = LZ4F_createDecompressionContext(&data->dctx,
+                LZ4F_VERSION);
+        if (LZ4F_isError(err)) {
+            LOGE("error allocating lz4 context: %s", LZ4F_getErrorName(err));
+            free(data);
+            return -1;
+        }
+        f->decomp_priv = data;
+    }
+
+    reset_lz4(f);
+    return 0;
+}
+
+static void close_lz4(frogfs_fh_t *f)
+{
+    decomp_priv_t *data = f->decomp_priv;
+    if (data == NULL) {
+        return;
+    }
+    LZ4F_freeDecompressionContext(data->dctx);
+    free(data->scratch);
+    free(data);
+    f->decomp_priv = NULL;
+}
+
+static ssize_t read_lz4(frogfs_fh_t *f, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len && PRIV(f)->out_pos + done < f->real_sz) {
+        size_t dst_sz = len - done;
+        size_t src_sz = f->data_sz - (f->data_ptr - f->data_start);
+
+        size_t ret = LZ4F_decompress(PRIV(f)->dctx, buf + done, &dst_sz,
+                f->data_ptr, &src_sz, NULL);
+        if (LZ4F_isError(ret)) {
+            LOGE("LZ4F_decompress: %s", LZ4F_getErrorName(ret));
+            return -1;
+        }
+        if (src_sz == 0 && dst_sz == 0) {
+            /* truncated frame */
+            LOGE("LZ4F_decompress: no progress");
+            return -1;
+        }
+        f->data_ptr += src_sz;
+        done += dst_sz;
+    }
+
+    PRIV(f)->out_pos += done;
+    return done;
+}
+
+// Returns the block maximum size from the frame header's BD byte.
+static size_t block_max_lz4(frogfs_fh_t *f)
+{
+    const uint8_t *p = f->data_start;
+    if (f->data_sz < 7) {
+        return 0;
+    }
+    uint8_t id = (p[5] >> 4) & 7;
+    if (id < 4) {
+        return 0;
+    }
+    return (size_t) 1 << (8 + 2 * id);
+}
+
+static ssize_t skip_lz4(frogfs_fh_t *f, size_t len)
+{
+    size_t block_max = block_max_lz4(f);
+    size_t done = 0;
+
+    if (block_max == 0) {
+        LOGE("invalid lz4 frame header");
+        return -1;
+    }
+    if (PRIV(f)->scratch_len < block_max) {
+        /* pooled contexts keep the largest block size seen */
+        free(PRIV(f)->scratch);
+        PRIV(f)->scratch_len = 0;
+        PRIV(f)->scratch = malloc(block_max);
+        if (PRIV(f)->scratch == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+        PRIV(f)->scratch_len = block_max;
+    }
+
+    /* whole blocks decode straight into scratch, without lz4 buffering */
+    while (done < len && PRIV(f)->out_pos + done < f->real_sz) {
+        size_t dst_sz = len - done < block_max ? len - done : block_max;
+        size_t src_sz = f->data_sz - (f->data_ptr - f->data_start);
+
+        size_t ret = LZ4F_decompress(PRIV(f)->dctx, PRIV(f)->scratch,
+                &dst_sz, f->data_ptr, &src_sz, NULL);
+        if (LZ4F_isError(ret)) {
+            LOGE("LZ4F_decompress: %s", LZ4F_getErrorName(ret));
+            return -1;
+        }
+        if (src_sz == 0 && dst_sz == 0) {
+            /* truncated frame */
+            LOGE("LZ4F_decompress: no progress");
+            return -1;
+        }
+        f->data_ptr += src_sz;
+        done += dst_sz;
+    }
+
+    PRIV(f)->out_pos += done;
+    return done;
+}
+
+static ssize_t seek_lz4(frogfs_fh_t *f, long offset, int mode)
+{
+    const frogfs_comp_t *comp = (const void *) f->file;
+    ssize_t new_pos = PRIV(f)->out_pos;
+
+    if (mode == SEEK_SET) {
+        if (offset < 0) {
+            return -1;
+        }
+        if (offset > comp->real_sz) {
+            offset = comp->real_sz;
+        }
+        new_pos = offset;
+    } else if (mode == SEEK_CUR) {
+        if (new_pos + offset < 0) {
+            new_pos = 0;
+        } else if (new_pos + offset > (ssize_t) comp->real_sz) {
+            new_pos = comp->real_sz;
+        } else {
+            new_pos += offset;
+        }
+    } else if (mode == SEEK_END) {
+        if (offset > 0) {
+            return -1;
+        }
+        if (offset < -(ssize_t) comp->real_sz) {
+            offset = -(ssize_t) comp->real_sz;
+        }
+        new_pos = comp->real_sz + offset;
+    } else {
+        return -1;
+    }
+
+    if (new_pos < PRIV(f)->out_pos) {
+        reset_lz4(f);
+    }
+
+    if (new_pos > PRIV(f)->out_pos) {
+        if (skip_lz4(f, new_pos - PRIV(f)->out_pos) < 0) {
+            return -1;
+        }
+    }
+
+    return PRIV(f)->out_pos;
+}
+
+static size_t tell_lz4(frogfs_fh_t *f)
+{
+    return PRIV(f)->out_pos;
+}
+
+const frogfs_decomp_funcs_t frogfs_decomp_lz4 = {
+    .open = open_lz4,
+    .close = close_lz4,
+    .read = read_lz4,
+    .seek = seek_lz4,
+    .tell = tell_lz4,
+    .skip = skip_lz4,
+};
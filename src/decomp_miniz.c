@@ -17,31 +17,87 @@
 #include "frogfs/frogfs.h"
 
 
-#define BUFFER_LEN 16
-
 typedef struct {
     const void *data;
+    const void *dict;
+    size_t dict_len;
     tinfl_decompressor inflator;
-    uint8_t buf[TINFL_LZ_DICT_SIZE];
+    uint8_t *buf; /* TINFL_LZ_DICT_SIZE ring, NULL until streaming */
     size_t buf_pos;
     size_t buf_len;
     size_t out_pos;
+#if CONFIG_FROGFS_USE_LIBDEFLATE == 1
+    struct libdeflate_decompressor *inflater; /* NULL until a whole read */
+#endif
 } priv_data_t;
 
+// Allocates the output ring used for streaming reads.
+static int alloc_buf(priv_data_t *priv)
+{
+    if (priv->buf == NULL) {
+        priv->buf = malloc(TINFL_LZ_DICT_SIZE);
+        if (priv->buf == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Restarts decompression at the start of the deflate stream.
+static void reset_miniz(frogfs_fh_t *f)
+{
+    priv_data_t *priv = f->decomp_priv;
+
+    f->data_ptr = priv->data;
+    tinfl_init(&priv->inflator);
+    priv->buf_len = 0;
+    priv->buf_pos = 0;
+    priv->out_pos = 0;
+    if (priv->dict) {
+        /* preload the dictionary where the output wraps, as for a seek
+         * checkpoint window */
+        memcpy(priv->buf + TINFL_LZ_DICT_SIZE - priv->dict_len, priv->dict,
+                priv->dict_len);
+        priv->buf_len = TINFL_LZ_DICT_SIZE;
+        priv->buf_pos = TINFL_LZ_DICT_SIZE;
+    }
+}
+
 static int open_miniz(frogfs_fh_t *f, unsigned int flags)
 {
-    priv_data_t *priv = malloc(sizeof(priv_data_t));
+    priv_data_t *priv = f->decomp_priv;
     if (priv == NULL) {
-        LOGE("malloc failed");
-        return -1;
+        priv = malloc(sizeof(priv_data_t));
+        if (priv == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+        priv->buf = NULL;
+#if CONFIG_FROGFS_USE_LIBDEFLATE == 1
+        priv->inflater = NULL;
+#endif
+        f->decomp_priv = priv;
     }
 
-    const char *p = f->data_start;
+    const uint8_t *p = f->data_start;
     priv->data = f->data_start;
-    if (*p == 0x78 && (*(p + 1) == 0x01 || *(p + 1) == 0x5e ||
-            *(p + 1) == 0x9c || *(p + 1) == 0xda)) {
+    priv->dict = NULL;
+    priv->dict_len = 0;
+    if ((p[0] & 0x0f) == 8 && ((p[0] << 8) | p[1]) % 31 == 0) {
         /* zlib */
         priv->data += 2;
+        if (p[1] & 0x20) {
+            /* shared dictionary, named by its big-endian adler32 */
+            uint32_t id = ((uint32_t) p[2] << 24) | (p[3] << 16) |
+                    (p[4] << 8) | p[5];
+            priv->dict = frogfs_find_dict(f->fs, id, &priv->dict_len);
+            if (priv->dict == NULL) {
+                LOGE("dictionary %08x not found", id);
+                return -1;
+            }
+            priv->data += 4;
+        }
     } else if (*p == 0x1f && *(p + 1) == 0x8b) {
         /* gzip */
         if (*(p + 2) != 8) {
@@ -71,22 +127,56 @@ static int open_miniz(frogfs_fh_t *f, unsigned int flags)
         /* assume raw deflate stream */
     }
 
-    f->data_ptr = priv->data;
-    tinfl_init(&priv->inflator);
-    priv->buf_pos = 0;
-    priv->buf_len = 0;
-    priv->out_pos = 0;
-    f->decomp_priv = priv;
+    /* whole file reads decode straight into the caller's buffer, unless
+     * back references reach into a preset dictionary */
+    if (!(flags & FROGFS_OPEN_WHOLE) || priv->dict) {
+        if (alloc_buf(priv) < 0) {
+            return -1;
+        }
+    }
+
+    reset_miniz(f);
     return 0;
 }
 
 static void close_miniz(frogfs_fh_t *f)
 {
     priv_data_t *priv = f->decomp_priv;
+    if (priv == NULL) {
+        return;
+    }
+    free(priv->buf);
+#if CONFIG_FROGFS_USE_LIBDEFLATE == 1
+    frogfs_inflate_free(priv->inflater);
+#endif
     free(priv);
     f->decomp_priv = NULL;
 }
 
+// Inflates more output into the ring once the reader has caught up.
+static int refill_miniz(frogfs_fh_t *f)
+{
+    priv_data_t *priv = f->decomp_priv;
+
+    if (priv->buf_len == priv->buf_pos) {
+        priv->buf_len = 0;
+        priv->buf_pos = 0;
+    }
+
+    size_t in_bytes = f->data_sz - (f->data_ptr - f->data_start);
+    size_t out_bytes = TINFL_LZ_DICT_SIZE - priv->buf_len;
+    tinfl_status status = tinfl_decompress(&priv->inflator, f->data_ptr,
+            &in_bytes, priv->buf, &priv->buf[priv->buf_len], &out_bytes, 0);
+    f->data_ptr += in_bytes;
+    priv->buf_len += out_bytes;
+
+    if (status < TINFL_STATUS_DONE) {
+        LOGE("tinfl_decompress");
+        return -1;
+    }
+    return 0;
+}
+
 static ssize_t read_miniz(frogfs_fh_t *f, void *buf, size_t len)
 {
     priv_data_t *priv = f->decomp_priv;
@@ -95,6 +185,30 @@ static ssize_t read_miniz(frogfs_fh_t *f, void *buf, size_t len)
     size_t in_bytes;
     size_t out_bytes;
 
+    if (priv->out_pos == f->real_sz) {
+        return 0;
+    }
+
+    if (priv->out_pos == 0 && priv->buf_len == 0 && len >= f->real_sz) {
+        /* the whole file fits, so inflate into buf without the ring */
+        in_bytes = f->data_sz - (f->data_ptr - f->data_start);
+        out_bytes = f->real_sz;
+        status = tinfl_decompress(&priv->inflator, f->data_ptr, &in_bytes,
+                buf, buf, &out_bytes,
+                TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+        if (status != TINFL_STATUS_DONE || out_bytes != f->real_sz) {
+            LOGE("tinfl_decompress");
+            return -1;
+        }
+        f->data_ptr += in_bytes;
+        priv->out_pos = f->real_sz;
+        return f->real_sz;
+    }
+
+    if (alloc_buf(priv) < 0) {
+        return -1;
+    }
+
     while (len) {
         size_t chunk = len < priv->buf_len - priv->buf_pos ? len :
                 priv->buf_len - priv->buf_pos;
@@ -104,20 +218,36 @@ static ssize_t read_miniz(frogfs_fh_t *f, void *buf, size_t len)
         buf += chunk;
         len -= chunk;
 
-        if (priv->buf_len == priv->buf_pos) {
-            priv->buf_len = 0;
-            priv->buf_pos = 0;
+        if (refill_miniz(f) < 0) {
+            return -1;
         }
 
-        in_bytes = f->data_sz - (f->data_ptr - priv->data);
-        out_bytes = sizeof(priv->buf) - priv->buf_len;
-        status = tinfl_decompress(&priv->inflator, f->data_ptr, &in_bytes,
-                priv->buf, &priv->buf[priv->buf_len], &out_bytes, 0);
-        f->data_ptr += in_bytes;
-        priv->buf_len += out_bytes;
+        if (priv->buf_len - priv->buf_pos == 0) {
+            break;
+        }
+    }
 
-        if (status < TINFL_STATUS_DONE) {
-            LOGE("tinfl_decompress");
+    return start_len - len;
+}
+
+static ssize_t skip_miniz(frogfs_fh_t *f, size_t len)
+{
+    priv_data_t *priv = f->decomp_priv;
+    size_t start_len = len;
+
+    if (alloc_buf(priv) < 0) {
+        return -1;
+    }
+
+    /* the ring already holds the output, so skipping only moves past it */
+    while (len) {
+        size_t chunk = len < priv->buf_len - priv->buf_pos ? len :
+                priv->buf_len - priv->buf_pos;
+        priv->buf_pos += chunk;
+        priv->out_pos += chunk;
+        len -= chunk;
+
+        if (refill_miniz(f) < 0) {
             return -1;
         }
 
@@ -129,6 +259,21 @@ static ssize_t read_miniz(frogfs_fh_t *f, void *buf, size_t len)
     return start_len - len;
 }
 
+static ssize_t read_all_miniz(frogfs_fh_t *f, void *buf)
+{
+#if CONFIG_FROGFS_USE_LIBDEFLATE == 1
+    priv_data_t *priv = f->decomp_priv;
+    if (frogfs_inflate_all(f, buf, &priv->inflater) == 0) {
+        /* leave the stream at the end, a seek back resets it */
+        priv->out_pos = f->real_sz;
+        priv->buf_len = 0;
+        priv->buf_pos = 0;
+        return f->real_sz;
+    }
+#endif
+    return read_miniz(f, buf, f->real_sz);
+}
+
 static ssize_t seek_miniz(frogfs_fh_t *f, long offset, int mode)
 {
     priv_data_t *priv = f->decomp_priv;
@@ -146,7 +291,7 @@ static ssize_t seek_miniz(frogfs_fh_t *f, long offset, int mode)
     } else if (mode == SEEK_CUR) {
         if (new_pos + offset < 0) {
             new_pos = 0;
-        } else if (new_pos > comp->real_sz) {
+        } else if (new_pos + offset > (ssize_t) comp->real_sz) {
             new_pos = comp->real_sz;
         } else {
             new_pos += offset;
@@ -156,29 +301,35 @@ static ssize_t seek_miniz(frogfs_fh_t *f, long offset, int mode)
             return -1;
         }
         if (offset < -(ssize_t) comp->real_sz) {
-            offset = 0;
+            offset = -(ssize_t) comp->real_sz;
         }
         new_pos = comp->real_sz + offset;
     } else {
         return -1;
     }
 
-    if (new_pos < priv->out_pos) {
-        f->data_ptr = priv->data;
+    const void *window;
+    const frogfs_ckpt_t *ckpt = frogfs_find_ckpt(f, new_pos, &window);
+    if (ckpt && (new_pos < priv->out_pos || ckpt->out_offs > priv->out_pos)) {
+        /* resume at the checkpoint, with the window ending where the
+         * dictionary wraps so that back references find it */
+        size_t window_sz = ckpt->out_offs < FROGFS_CKPT_WINDOW ?
+                ckpt->out_offs : FROGFS_CKPT_WINDOW;
+        if (alloc_buf(priv) < 0) {
+            return -1;
+        }
+        f->data_ptr = f->data_start + ckpt->in_offs;
         tinfl_init(&priv->inflator);
-        priv->buf_len = 0;
-        priv->buf_pos = 0;
-        priv->out_pos = 0;
+        memcpy(priv->buf + TINFL_LZ_DICT_SIZE - window_sz, window, window_sz);
+        priv->buf_len = TINFL_LZ_DICT_SIZE;
+        priv->buf_pos = TINFL_LZ_DICT_SIZE;
+        priv->out_pos = ckpt->out_offs;
+    } else if (new_pos < priv->out_pos) {
+        reset_miniz(f);
     }
 
-    while (new_pos > priv->out_pos) {
-        uint8_t buf[BUFFER_LEN];
-        size_t len = new_pos - priv->out_pos < BUFFER_LEN ?
-                new_pos - priv->out_pos : BUFFER_LEN;
-
-        ssize_t res = frogfs_read(f, buf, len);
-        if (res < 0) {
-            LOGE("frogfs_read");
+    if (new_pos > priv->out_pos) {
+        if (skip_miniz(f, new_pos - priv->out_pos) < 0) {
             return -1;
         }
     }
@@ -198,4 +349,6 @@ const frogfs_decomp_funcs_t frogfs_decomp_miniz = {
     .read = read_miniz,
     .seek = seek_miniz,
     .tell = tell_miniz,
+    .read_all = read_all_miniz,
+    .skip = skip_miniz,
 };
@@ -15,7 +15,8 @@
 
 static ssize_t read_raw(frogfs_fh_t *f, void *buf, size_t len)
 {
-    size_t remaining = f->data_sz - (f->data_ptr - f->data_start);
+    size_t pos = f->data_ptr - f->data_start;
+    size_t remaining = pos < f->data_sz ? f->data_sz - pos : 0;
 
     if (len > remaining) {
         len = remaining;
@@ -44,7 +45,7 @@ static ssize_t seek_raw(frogfs_fh_t *f, long offset, int mode)
     } else if (mode == SEEK_CUR) {
         if (new_pos + offset < 0) {
             new_pos = 0;
-        } else if (new_pos > f->data_sz) {
+        } else if (new_pos + offset > (ssize_t) f->data_sz) {
             new_pos = f->data_sz;
         } else {
             new_pos += offset;
@@ -54,7 +55,7 @@ static ssize_t seek_raw(frogfs_fh_t *f, long offset, int mode)
             return -1;
         }
         if (offset < -(ssize_t) f->data_sz) {
-            offset = 0;
+            offset = -(ssize_t) f->data_sz;
         }
         new_pos = f->data_sz + offset;
     } else {
@@ -18,38 +18,78 @@
 #include "frogfs/frogfs.h"
 
 
-#define BUFFER_LEN 16
-#define STREAM(f) ((z_stream *)(f->decomp_priv))
+#define SCRATCH_LEN (1 << MAX_WBITS)
+#define PRIV(f) ((decomp_priv_t *)(f->decomp_priv))
+#define STREAM(f) (&PRIV(f)->stream)
+
+typedef struct {
+    z_stream stream;
+    uint8_t *scratch; /* SCRATCH_LEN bytes for skipped output, or NULL */
+#if CONFIG_FROGFS_USE_LIBDEFLATE == 1
+    struct libdeflate_decompressor *inflater; /* NULL until a whole read */
+#endif
+} decomp_priv_t;
 
 static int open_zlib(frogfs_fh_t *f, unsigned int flags)
 {
     int ret;
 
-    z_stream *stream = malloc(sizeof(z_stream));
-    if (stream == NULL) {
+    if (f->decomp_priv != NULL) {
+        /* pooled stream, which may have been left in raw mode by a seek */
+        inflateReset2(STREAM(f), MAX_WBITS | 32);
+        return 0;
+    }
+
+    decomp_priv_t *data = malloc(sizeof(decomp_priv_t));
+    if (data == NULL) {
         LOGE("malloc failed");
         return -1;
     }
-    memset(stream, 0, sizeof(*stream));
+    memset(data, 0, sizeof(*data));
 
-    ret = inflateInit2(stream, MAX_WBITS | 32);
+    ret = inflateInit2(&data->stream, MAX_WBITS | 32);
     if (ret != Z_OK) {
         LOGE("error allocating zlib stream");
+        free(data);
         return -1;
     }
 
-    f->decomp_priv = stream;
+    f->decomp_priv = data;
     return 0;
 }
 
 static void close_zlib(frogfs_fh_t *f)
 {
-    z_stream *stream = STREAM(f);
-    inflateEnd(stream);
-    free(stream);
+    decomp_priv_t *data = f->decomp_priv;
+    if (data == NULL) {
+        return;
+    }
+    inflateEnd(&data->stream);
+    free(data->scratch);
+#if CONFIG_FROGFS_USE_LIBDEFLATE == 1
+    frogfs_inflate_free(data->inflater);
+#endif
+    free(data);
     f->decomp_priv = NULL;
 }
 
+// Supplies the shared dictionary named by the zlib header.
+static int set_dict_zlib(frogfs_fh_t *f)
+{
+    /* inflate returns Z_NEED_DICT without counting the header it read */
+    STREAM(f)->total_in += STREAM(f)->next_in - (const Bytef *) f->data_ptr;
+    f->data_ptr = STREAM(f)->next_in;
+
+    size_t dict_len;
+    const void *dict = frogfs_find_dict(f->fs, STREAM(f)->adler, &dict_len);
+    if (dict == NULL) {
+        LOGE("dictionary %08lx not found", STREAM(f)->adler);
+        return -1;
+    }
+    inflateSetDictionary(STREAM(f), dict, dict_len);
+    return 0;
+}
+
 static ssize_t read_zlib(frogfs_fh_t *f, void *buf, size_t len)
 {
     size_t start_in, start_out;
@@ -59,23 +99,92 @@ static ssize_t read_zlib(frogfs_fh_t *f, void *buf, size_t len)
         return 0;
     }
 
-    start_in = STREAM(f)->total_in;
     start_out = STREAM(f)->total_out;
 
+    /* when the rest of the file fits, finishing in one call lets inflate
+     * skip allocating its sliding window */
+    int flush = len >= f->real_sz - start_out ? Z_FINISH : Z_NO_FLUSH;
+
     while (STREAM(f)->total_in < f->data_sz &&
             STREAM(f)->total_out - start_out < len) {
+        size_t done = STREAM(f)->total_out - start_out;
+        start_in = STREAM(f)->total_in;
         STREAM(f)->next_in = f->data_ptr;
         STREAM(f)->avail_in = f->data_sz - \
                 (f->data_ptr - f->data_start);
-        STREAM(f)->next_out = buf;
-        STREAM(f)->avail_out = len;
+        STREAM(f)->next_out = buf + done;
+        STREAM(f)->avail_out = len - done;
 
-        ret = inflate(STREAM(f), Z_NO_FLUSH);
+        ret = inflate(STREAM(f), flush);
+        if (ret == Z_NEED_DICT) {
+            if (set_dict_zlib(f) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        f->data_ptr += STREAM(f)->total_in - start_in;
         if (ret < 0) {
             LOGE("inflate");
             return -1;
         }
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+    }
+
+    return STREAM(f)->total_out - start_out;
+}
+
+static ssize_t read_all_zlib(frogfs_fh_t *f, void *buf)
+{
+#if CONFIG_FROGFS_USE_LIBDEFLATE == 1
+    if (frogfs_inflate_all(f, buf, &PRIV(f)->inflater) == 0) {
+        /* leave the stream at the end, a seek back resets it */
+        STREAM(f)->total_out = f->real_sz;
+        f->data_ptr = f->data_start + f->data_sz;
+        return f->real_sz;
+    }
+#endif
+    /* inflate writes straight into buf, in as few calls as it needs */
+    return read_zlib(f, buf, f->real_sz);
+}
+
+static ssize_t skip_zlib(frogfs_fh_t *f, size_t len)
+{
+    size_t start_in, start_out;
+    int ret;
+
+    if (PRIV(f)->scratch == NULL) {
+        PRIV(f)->scratch = malloc(SCRATCH_LEN);
+        if (PRIV(f)->scratch == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+    }
+
+    /* inflate a window at a time into the context's scratch buffer */
+    start_out = STREAM(f)->total_out;
+    while (STREAM(f)->total_in < f->data_sz &&
+            STREAM(f)->total_out - start_out < len) {
+        size_t remain = len - (STREAM(f)->total_out - start_out);
+        start_in = STREAM(f)->total_in;
+        STREAM(f)->next_in = f->data_ptr;
+        STREAM(f)->avail_in = f->data_sz - (f->data_ptr - f->data_start);
+        STREAM(f)->next_out = PRIV(f)->scratch;
+        STREAM(f)->avail_out = remain < SCRATCH_LEN ? remain : SCRATCH_LEN;
+
+        ret = inflate(STREAM(f), Z_NO_FLUSH);
+        if (ret == Z_NEED_DICT) {
+            if (set_dict_zlib(f) < 0) {
+                return -1;
+            }
+            continue;
+        }
         f->data_ptr += STREAM(f)->total_in - start_in;
+        if (ret < 0) {
+            LOGE("inflate");
+            return -1;
+        }
         if (ret == Z_STREAM_END) {
             break;
         }
@@ -100,7 +209,7 @@ static ssize_t seek_zlib(frogfs_fh_t *f, long offset, int mode)
     } else if (mode == SEEK_CUR) {
         if (new_pos + offset < 0) {
             new_pos = 0;
-        } else if (new_pos > comp->real_sz) {
+        } else if (new_pos + offset > (ssize_t) comp->real_sz) {
             new_pos = comp->real_sz;
         } else {
             new_pos += offset;
@@ -110,26 +219,32 @@ static ssize_t seek_zlib(frogfs_fh_t *f, long offset, int mode)
             return -1;
         }
         if (offset < -(ssize_t) comp->real_sz) {
-            offset = 0;
+            offset = -(ssize_t) comp->real_sz;
         }
         new_pos = comp->real_sz + offset;
     } else {
         return -1;
     }
 
-    if (new_pos < STREAM(f)->total_out) {
+    const void *window;
+    const frogfs_ckpt_t *ckpt = frogfs_find_ckpt(f, new_pos, &window);
+    if (ckpt && (new_pos < STREAM(f)->total_out ||
+            ckpt->out_offs > STREAM(f)->total_out)) {
+        /* resume raw inflate at the checkpoint */
+        size_t window_sz = ckpt->out_offs < FROGFS_CKPT_WINDOW ?
+                ckpt->out_offs : FROGFS_CKPT_WINDOW;
+        inflateReset2(STREAM(f), -MAX_WBITS);
+        inflateSetDictionary(STREAM(f), window, window_sz);
+        f->data_ptr = f->data_start + ckpt->in_offs;
+        STREAM(f)->total_in = ckpt->in_offs;
+        STREAM(f)->total_out = ckpt->out_offs;
+    } else if (new_pos < STREAM(f)->total_out) {
         f->data_ptr = f->data_start;
-        inflateReset(STREAM(f));
+        inflateReset2(STREAM(f), MAX_WBITS | 32);
     }
 
-    while (new_pos > STREAM(f)->total_out) {
-        uint8_t buf[BUFFER_LEN];
-        size_t len = new_pos - STREAM(f)->total_out < BUFFER_LEN ?
-                new_pos - STREAM(f)->total_out : BUFFER_LEN;
-
-        ssize_t res = frogfs_read(f, buf, len);
-        if (res < 0) {
-            LOGE("frogfs_read");
+    if (new_pos > STREAM(f)->total_out) {
+        if (skip_zlib(f, new_pos - STREAM(f)->total_out) < 0) {
             return -1;
         }
     }
@@ -148,4 +263,6 @@ const frogfs_decomp_funcs_t frogfs_decomp_zlib = {
     .read = read_zlib,
     .seek = seek_zlib,
     .tell = tell_zlib,
+    .read_all = read_all_zlib,
+    .skip = skip_zlib,
 };
@@ -0,0 +1,198 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "zstd.h"
+
+#include "frogfs_priv.h"
+#include "log.h"
+#include "frogfs_format.h"
+#include "frogfs/frogfs.h"
+
+
+#define PRIV(f) ((decomp_priv_t *)(f->decomp_priv))
+
+typedef struct {
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer in;
+    size_t out_pos;
+    void *scratch; /* ZSTD_DStreamOutSize() bytes for skipped output */
+} decomp_priv_t;
+
+// Restarts decompression at the start of the frame.
+static void reset_zstd(frogfs_fh_t *f)
+{
+    ZSTD_DCtx_reset(PRIV(f)->dctx, ZSTD_reset_session_only);
+    PRIV(f)->in.src = f->data_start;
+    PRIV(f)->in.size = f->data_sz;
+    PRIV(f)->in.pos = 0;
+    PRIV(f)->out_pos = 0;
+    f->data_ptr = f->data_start;
+}
+
+static int open_zstd(frogfs_fh_t *f, unsigned int flags)
+{
+    if (f->decomp_priv == NULL) {
+        decomp_priv_t *data = malloc(sizeof(decomp_priv_t));
+        if (data == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+
+        data->scratch = NULL;
+        data->dctx = ZSTD_createDCtx();
+        if (data->dctx == NULL) {
+            LOGE("error allocating zstd context");
+            free(data);
+            return -1;
+        }
+        f->decomp_priv = data;
+    }
+
+    reset_zstd(f);
+    return 0;
+}
+
+static void close_zstd(frogfs_fh_t *f)
+{
+    decomp_priv_t *data = f->decomp_priv;
+    if (data == NULL) {
+        return;
+    }
+    ZSTD_freeDCtx(data->dctx);
+    free(data->scratch);
+    free(data);
+    f->decomp_priv = NULL;
+}
+
+static ssize_t read_zstd(frogfs_fh_t *f, void *buf, size_t len)
+{
+    ZSTD_outBuffer out = { .dst = buf, .size = len, .pos = 0 };
+
+    while (out.pos < out.size && PRIV(f)->out_pos + out.pos < f->real_sz) {
+        size_t in_pos = PRIV(f)->in.pos;
+        size_t out_pos = out.pos;
+
+        size_t ret = ZSTD_decompressStream(PRIV(f)->dctx, &out, &PRIV(f)->in);
+        if (ZSTD_isError(ret)) {
+            LOGE("ZSTD_decompressStream: %s", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (PRIV(f)->in.pos == in_pos && out.pos == out_pos) {
+            /* truncated frame */
+            LOGE("ZSTD_decompressStream: no progress");
+            return -1;
+        }
+    }
+
+    f->data_ptr = f->data_start + PRIV(f)->in.pos;
+    PRIV(f)->out_pos += out.pos;
+    return out.pos;
+}
+
+static ssize_t skip_zstd(frogfs_fh_t *f, size_t len)
+{
+    size_t scratch_len = ZSTD_DStreamOutSize();
+    size_t done = 0;
+
+    if (PRIV(f)->scratch == NULL) {
+        PRIV(f)->scratch = malloc(scratch_len);
+        if (PRIV(f)->scratch == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+    }
+
+    /* a whole block at a time, so zstd can decode straight into scratch */
+    while (done < len && PRIV(f)->out_pos + done < f->real_sz) {
+        ZSTD_outBuffer out = {
+            .dst = PRIV(f)->scratch,
+            .size = len - done < scratch_len ? len - done : scratch_len,
+            .pos = 0,
+        };
+        size_t in_pos = PRIV(f)->in.pos;
+
+        size_t ret = ZSTD_decompressStream(PRIV(f)->dctx, &out, &PRIV(f)->in);
+        if (ZSTD_isError(ret)) {
+            LOGE("ZSTD_decompressStream: %s", ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (PRIV(f)->in.pos == in_pos && out.pos == 0) {
+            /* truncated frame */
+            LOGE("ZSTD_decompressStream: no progress");
+            return -1;
+        }
+        done += out.pos;
+    }
+
+    f->data_ptr = f->data_start + PRIV(f)->in.pos;
+    PRIV(f)->out_pos += done;
+    return done;
+}
+
+static ssize_t seek_zstd(frogfs_fh_t *f, long offset, int mode)
+{
+    const frogfs_comp_t *comp = (const void *) f->file;
+    ssize_t new_pos = PRIV(f)->out_pos;
+
+    if (mode == SEEK_SET) {
+        if (offset < 0) {
+            return -1;
+        }
+        if (offset > comp->real_sz) {
+            offset = comp->real_sz;
+        }
+        new_pos = offset;
+    } else if (mode == SEEK_CUR) {
+        if (new_pos + offset < 0) {
+            new_pos = 0;
+        } else if (new_pos + offset > (ssize_t) comp->real_sz) {
+            new_pos = comp->real_sz;
+        } else {
+            new_pos += offset;
+        }
+    } else if (mode == SEEK_END) {
+        if (offset > 0) {
+            return -1;
+        }
+        if (offset < -(ssize_t) comp->real_sz) {
+            offset = -(ssize_t) comp->real_sz;
+        }
+        new_pos = comp->real_sz + offset;
+    } else {
+        return -1;
+    }
+
+    if (new_pos < PRIV(f)->out_pos) {
+        reset_zstd(f);
+    }
+
+    if (new_pos > PRIV(f)->out_pos) {
+        if (skip_zstd(f, new_pos - PRIV(f)->out_pos) < 0) {
+            return -1;
+        }
+    }
+
+    return PRIV(f)->out_pos;
+}
+
+static size_t tell_zstd(frogfs_fh_t *f)
+{
+    return PRIV(f)->out_pos;
+}
+
+const frogfs_decomp_funcs_t frogfs_decomp_zstd = {
+    .open = open_zstd,
+    .close = close_zstd,
+    .read = read_zstd,
+    .seek = seek_zstd,
+    .tell = tell_zstd,
+    .skip = skip_zstd,
+};
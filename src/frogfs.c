@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -18,11 +19,23 @@
 #include <string.h>
 
 #include "frogfs_config.h" 
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+# include <pthread.h>
+#endif
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+#endif
 #if defined(ESP_PLATFORM)
 # if !defined(CONFIG_IDF_TARGET_ESP8266)
 #  include "esp_partition.h"
+#  include "esp_rom_crc.h"
 #  include "spi_flash_mmap.h"
+#  define CRC32_USE_ROM
 # endif
+#elif defined(__ARM_FEATURE_CRC32)
+# include <arm_acle.h>
 #endif
 
 #include "log.h"
@@ -31,16 +44,171 @@
 #include "frogfs/frogfs.h"
 
 
+#if defined(__GNUC__)
+# define PREFETCH(p) __builtin_prefetch(p)
+#else
+# define PREFETCH(p)
+#endif
+
+#define BATCH_LEN 16
+#define CRC32_POLY 0xedb88320
+#define CRC32_MIN_PART 65536
+#if defined(CRC32_USE_ROM) || defined(__ARM_FEATURE_CRC32)
+# define CRC32_TABLE_LEN 0
+#else
+# define CRC32_TABLE_LEN (16 * 256)
+#endif
+
+/**
+ * \brief       Lookup cache slot
+ */
+typedef struct frogfs_lookup_slot_t {
+    uint32_t hash; /**< path hash */
+    const frogfs_entry_t *entry; /**< cached entry */
+} frogfs_lookup_slot_t;
+
+/**
+ * \brief       Direct mapped cache of recently found entries, indexed by path
+ *              hash. Slots are only hints and are verified against the path,
+ *              so racing updates are harmless.
+ */
+typedef struct frogfs_lookup_cache_t {
+    size_t hits; /**< cache hits */
+    size_t misses; /**< cache misses */
+    uint32_t mask; /**< slot count - 1 */
+    frogfs_lookup_slot_t slots[]; /**< cached entries */
+} frogfs_lookup_cache_t;
+
+/**
+ * \brief       Decompressed copy of a file
+ */
+typedef struct frogfs_content_t {
+    struct frogfs_content_t *prev; /**< more recently used */
+    struct frogfs_content_t *next; /**< less recently used */
+    struct frogfs_content_t *chain; /**< next in the same hash bucket */
+    const frogfs_file_t *file; /**< file header pointer */
+    size_t refs; /**< open handles using the data */
+    size_t len; /**< data length */
+    bool cached; /**< linked into the cache list */
+    uint8_t data[]; /**< decompressed data */
+} frogfs_content_t;
+
+#define CONTENT_BUCKETS 32
+
+/**
+ * \brief       Least recently used cache of decompressed files
+ */
+typedef struct frogfs_content_cache_t {
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    pthread_mutex_t lock; /**< protects everything below */
+#endif
+    frogfs_content_t *head; /**< most recently used */
+    frogfs_content_t *tail; /**< least recently used */
+    frogfs_content_t *buckets[CONTENT_BUCKETS]; /**< hash by file pointer */
+    size_t budget; /**< maximum bytes of data */
+    size_t bytes; /**< current bytes of data */
+    size_t hits; /**< opens served from the cache */
+    size_t misses; /**< opens that decompressed */
+    size_t evictions; /**< entries evicted */
+} frogfs_content_cache_t;
+
 typedef struct frogfs_fs_t {
 #if defined(ESP_PLATFORM) && !defined(CONFIG_IDF_TARGET_ESP8266)
     spi_flash_mmap_handle_t mmap_handle;
 #endif
     const frogfs_head_t *head; /**< fs header pointer */
     const frogfs_hash_t *hash; /**< hash table pointer */
+    const uint32_t *btree_keys; /**< B-tree hash array pointer */
+    const uint32_t *btree_offs; /**< B-tree offset array pointer */
+    int btree_nodes; /**< B-tree node count */
+    const frogfs_mph_t *mph; /**< minimal perfect hash pointer */
+    const frogfs_bloom_t *bloom; /**< bloom filter pointer */
+    const frogfs_dicts_t *dicts; /**< dictionary section pointer */
     const frogfs_dir_t *root; /**< root directory entry */
     int num_entries; /**< total number of file system entries */
+    int num_hashes; /**< hash table length, including padding */
+    uint16_t flags; /**< header feature flags */
+    frogfs_lookup_cache_t *cache; /**< lookup cache or NULL */
+    frogfs_content_cache_t *content_cache; /**< content cache or NULL */
+    frogfs_fh_t *fh_pool; /**< file handle pool */
+    uint8_t *fh_pool_used; /**< file handle pool slots in use */
+    size_t fh_pool_len; /**< file handle pool length */
+    frogfs_decomp_ctx_t *decomp_pool; /**< decompressor context pool */
+    size_t decomp_pool_len; /**< decompressor context pool length */
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    pthread_t *workers; /**< decompression worker threads */
+    size_t num_workers; /**< decompression worker thread count */
+    pthread_mutex_t job_lock; /**< protects the job queue */
+    pthread_cond_t job_cond; /**< signalled when jobs are queued */
+    frogfs_job_t *job_head; /**< next job to run */
+    frogfs_job_t *job_tail; /**< last queued job */
+    bool stopping; /**< workers should exit */
+#endif
 } frogfs_fs_t;
 
+// Locks the content cache. Without pthreads the cache is not shared between
+// threads.
+static inline void content_lock(frogfs_content_cache_t *cache)
+{
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    pthread_mutex_lock(&cache->lock);
+#else
+    (void) cache;
+#endif
+}
+
+static inline void content_unlock(frogfs_content_cache_t *cache)
+{
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    pthread_mutex_unlock(&cache->lock);
+#else
+    (void) cache;
+#endif
+}
+
+// Frees the private data of an unused decompressor context.
+static void ctx_free(frogfs_decomp_ctx_t *ctx)
+{
+    if (ctx->priv && ctx->funcs->close) {
+        frogfs_fh_t fh = {
+            .decomp_funcs = ctx->funcs,
+            .decomp_priv = ctx->priv,
+        };
+        ctx->funcs->close(&fh);
+    }
+    ctx->funcs = NULL;
+    ctx->priv = NULL;
+}
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+// Runs queued jobs until the fs is deinitialized.
+static void *worker_main(void *arg)
+{
+    frogfs_fs_t *fs = arg;
+
+    pthread_mutex_lock(&fs->job_lock);
+    while (true) {
+        while (fs->job_head == NULL && !fs->stopping) {
+            pthread_cond_wait(&fs->job_cond, &fs->job_lock);
+        }
+        if (fs->job_head == NULL) {
+            break;
+        }
+        frogfs_job_t *job = fs->job_head;
+        fs->job_head = job->next;
+        if (fs->job_head == NULL) {
+            fs->job_tail = NULL;
+        }
+        pthread_mutex_unlock(&fs->job_lock);
+        job->run(job);
+        pthread_mutex_lock(&fs->job_lock);
+    }
+    pthread_mutex_unlock(&fs->job_lock);
+
+    return NULL;
+}
+#endif
+
 // Returns the current or next highest multiple of 4.
 static inline size_t align(size_t n)
 {
@@ -48,18 +216,79 @@ static inline size_t align(size_t n)
 }
 
 // String hashing function.
-static inline uint32_t djb2_hash(const char *s)
+static inline uint32_t djb2_hash(const char *s, size_t len)
 {
-    unsigned long hash = 5381;
+    uint32_t hash = 5381;
 
-    while (*s) {
+    while (len--) {
         /* hash = hash * 33 ^ c */
-        hash = ((hash << 5) + hash) ^ *s++;
+        hash = ((hash << 5) + hash) ^ (uint8_t) *s++;
     }
 
     return hash;
 }
 
+// Mixes one little endian word into a 64-bit hash state.
+static inline uint64_t hash64_round(uint64_t h, uint64_t w)
+{
+    w *= 0x87c37b91114253d5;
+    w ^= w >> 31;
+    h ^= w;
+    h *= 0x4cf5ad432745937f;
+    return h ^ (h >> 29);
+}
+
+// Seeded 64-bit string hashing function, consuming 8 bytes per round.
+static inline uint64_t hash64(const char *s, size_t len, uint64_t seed)
+{
+    uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15);
+    uint64_t w;
+
+    while (len >= 8) {
+        memcpy(&w, s, 8);
+        h = hash64_round(h, w);
+        s += 8;
+        len -= 8;
+    }
+
+    if (len > 0) {
+        w = 0;
+        memcpy(&w, s, len);
+        h = hash64_round(h, w);
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+}
+
+// Returns the hash table key for a path.
+static inline uint32_t path_hash(const frogfs_fs_t *fs, const char *path,
+        size_t len)
+{
+    if (fs->flags & FROGFS_HEAD_FLAG_HASH64) {
+        uint64_t h = hash64(path, len, fs->head->hash_seed);
+        return h ^ (h >> 32);
+    }
+
+    return djb2_hash(path, len);
+}
+
+// Integer mixing function used by the minimal perfect hash.
+static inline uint32_t mph_mix(uint32_t h, uint32_t seed)
+{
+    h ^= seed;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
 static const char *get_name(const frogfs_entry_t *entry)
 {
     if (FROGFS_IS_DIR(entry)) {
@@ -71,8 +300,451 @@ static const char *get_name(const frogfs_entry_t *entry)
     }
 }
 
+// Compares path against the entry's full path without building it, walking
+// the parent chain from the tail segment up to the root.
+static bool match_path(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, size_t len)
+{
+    if (entry->parent == 0) {
+        return len == 0;
+    }
+
+    while (true) {
+        if (entry->seg_sz > len) {
+            return false;
+        }
+        len -= entry->seg_sz;
+        if (memcmp(path + len, get_name(entry), entry->seg_sz) != 0) {
+            return false;
+        }
+
+        entry = (const void *) fs->head + entry->parent;
+        if ((const void *) entry == (const void *) fs->root) {
+            return len == 0;
+        }
+
+        if (len == 0 || path[len - 1] != '/') {
+            return false;
+        }
+        len--;
+    }
+}
+
+// Returns the hash at a hash table index.
+static inline uint32_t hash_key(const frogfs_fs_t *fs, int index)
+{
+    return fs->btree_keys ? fs->btree_keys[index] : fs->hash[index].hash;
+}
+
+// Returns the entry offset at a hash table index.
+static inline uint32_t hash_offs(const frogfs_fs_t *fs, int index)
+{
+    return fs->btree_keys ? fs->btree_offs[index] : fs->hash[index].offs;
+}
+
+// Returns true if dir lists its children in name order.
+static bool dir_sorted(const frogfs_fs_t *fs, const frogfs_dir_t *dir)
+{
+    for (int i = 1; i < dir->entry.child_count; i++) {
+        const frogfs_entry_t *a = (const void *) fs->head +
+                dir->children[i - 1];
+        const frogfs_entry_t *b = (const void *) fs->head +
+                dir->children[i];
+        size_t n = a->seg_sz < b->seg_sz ? a->seg_sz : b->seg_sz;
+        int cmp = memcmp(get_name(a), get_name(b), n);
+        if (cmp > 0 || (cmp == 0 && a->seg_sz >= b->seg_sz)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true if every directory lists its children in name order. mkfrogfs
+// has always sorted them, but the v1.0 header has no flag to say so.
+static bool children_sorted(const frogfs_fs_t *fs)
+{
+    if (!dir_sorted(fs, fs->root)) {
+        return false;
+    }
+    for (int i = 0; i < fs->num_entries; i++) {
+        const frogfs_entry_t *entry = (const void *) fs->head +
+                hash_offs(fs, i);
+        if (FROGFS_IS_DIR(entry) && !dir_sorted(fs, (const void *) entry)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the number of keys in a B-tree node that are less than hash.
+static inline int btree_rank(const uint32_t *node, uint32_t hash)
+{
+#if defined(__SSE2__)
+    /* SSE2 only has signed compares, so bias both sides */
+    const __m128i bias = _mm_set1_epi32(0x80000000);
+    __m128i x = _mm_xor_si128(_mm_set1_epi32(hash), bias);
+    int mask = 0;
+    for (int i = 0; i < FROGFS_BTREE_B; i += 4) {
+        __m128i k = _mm_xor_si128(_mm_loadu_si128(
+                (const __m128i *) (node + i)), bias);
+        mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x, k))) << i;
+    }
+    return __builtin_popcount(mask);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint32x4_t x = vdupq_n_u32(hash);
+    uint32x4_t sum = vdupq_n_u32(0);
+    for (int i = 0; i < FROGFS_BTREE_B; i += 4) {
+        /* lanes that compare true are all ones, i.e. -1 */
+        sum = vsubq_u32(sum, vcltq_u32(vld1q_u32(node + i), x));
+    }
+    return vaddvq_u32(sum);
+#else
+    int rank = 0;
+    for (int i = 0; i < FROGFS_BTREE_B; i++) {
+        rank += node[i] < hash;
+    }
+    return rank;
+#endif
+}
+
+// Searches the B-tree hash layout, returning the index of hash or -1.
+static int find_btree(const frogfs_fs_t *fs, uint32_t hash)
+{
+    int k = 0;
+
+    if (hash == FROGFS_BTREE_PAD) {
+        /* only padding slots have this hash */
+        return -1;
+    }
+
+    while (k < fs->btree_nodes) {
+        const uint32_t *node = fs->btree_keys + (k * FROGFS_BTREE_B);
+        int i = btree_rank(node, hash);
+        if (i < FROGFS_BTREE_B && node[i] == hash) {
+            return (k * FROGFS_BTREE_B) + i;
+        }
+        k = (k * (FROGFS_BTREE_B + 1)) + i + 1;
+    }
+
+    return -1;
+}
+
+// Returns false if hash is definitely not in the bloom filter.
+static bool bloom_check(const frogfs_bloom_t *bloom, uint32_t hash)
+{
+    const uint32_t *block = bloom->words +
+            ((mph_mix(hash, 1) % bloom->num_blocks) * 16);
+    uint32_t x = mph_mix(hash, 2);
+    uint32_t a = x & 0xFFFF;
+    uint32_t b = (x >> 16) | 1;
+
+    for (int i = 0; i < bloom->num_hashes; i++) {
+        uint32_t bit = (a + (i * b)) & 511;
+        if (!(block[bit >> 5] & (UINT32_C(1) << (bit & 31)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns the index of the first hash table entry matching hash, or -1. The
+// sorted table is only searched from index start onward.
+static int find_hash(const frogfs_fs_t *fs, uint32_t hash, int start)
+{
+    if (fs->bloom && !bloom_check(fs->bloom, hash)) {
+        return -1;
+    }
+
+    if (fs->mph) {
+        const uint16_t *slots = (const void *) fs->mph +
+                sizeof(frogfs_mph_t) + (fs->mph->num_buckets * 4);
+        uint32_t d = fs->mph->disp[mph_mix(hash, 0) % fs->mph->num_buckets];
+        uint32_t slot = (d & 0x80000000) ? d & 0x7FFFFFFF :
+                mph_mix(hash, d) % fs->mph->num_slots;
+        int index = slots[slot];
+        return hash_key(fs, index) == hash ? index : -1;
+    }
+
+    if (fs->btree_keys) {
+        return find_btree(fs, hash);
+    }
+
+    int first = start;
+    int last = fs->num_entries - 1;
+    int middle;
+
+    while (first <= last) {
+        middle = first + (last - first) / 2;
+        if (fs->hash[middle].hash == hash) {
+            break;
+        } else if (fs->hash[middle].hash < hash) {
+            first = middle + 1;
+        } else {
+            last = middle - 1;
+        }
+    }
+
+    if (first > last) {
+        return -1;
+    }
+
+    /* move to the first match */
+    while (middle > 0 && fs->hash[middle - 1].hash == hash) {
+        middle--;
+    }
+
+    return middle;
+}
+
+// Returns the entry matching path, starting with the candidate at index.
+static const frogfs_entry_t *find_entry(const frogfs_fs_t *fs, int index,
+        uint32_t hash, const char *path, size_t len)
+{
+    /* walk through canidates and look for a match, images with a seeded
+     * 64-bit hash have no duplicates so this verifies a single entry. This
+     * also holds for the B-tree layout, which requires the 64-bit hash */
+    do {
+        const frogfs_entry_t *entry = (const void *) fs->head +
+                hash_offs(fs, index);
+        if (match_path(fs, entry, path, len)) {
+            LOGV("entry %d", index);
+            return entry;
+        }
+        index++;
+    } while ((index < fs->num_hashes) && (hash_key(fs, index) == hash));
+
+    LOGW("unable to find entry");
+    return NULL;
+}
+
+// Prefetches the first memory a lookup of hash will touch.
+static inline void prefetch_probe(const frogfs_fs_t *fs, uint32_t hash)
+{
+    if (fs->bloom) {
+        PREFETCH(fs->bloom->words +
+                ((mph_mix(hash, 1) % fs->bloom->num_blocks) * 16));
+    } else if (fs->mph) {
+        PREFETCH(&fs->mph->disp[mph_mix(hash, 0) % fs->mph->num_buckets]);
+    }
+}
+
+#if CRC32_TABLE_LEN > 0
+// Builds the slice-by-16 crc32 tables.
+static void crc32_init_table(uint32_t (*t)[256])
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        t[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int s = 1; s < 16; s++) {
+            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+        }
+    }
+}
+#endif
+
+// Continues a zlib compatible crc32 over len bytes.
+static uint32_t crc32_update(const uint32_t (*t)[256], uint32_t crc,
+        const uint8_t *p, size_t len)
+{
+#if defined(CRC32_USE_ROM)
+    return esp_rom_crc32_le(crc, p, len);
+#elif defined(__ARM_FEATURE_CRC32)
+    crc = ~crc;
+    while (len && ((uintptr_t) p & 7)) {
+        crc = __crc32b(crc, *p++);
+        len--;
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        crc = __crc32d(crc, *(const uint64_t *) p);
+    }
+    while (len--) {
+        crc = __crc32b(crc, *p++);
+    }
+    return ~crc;
+#else
+    crc = ~crc;
+# if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 16; p += 16, len -= 16) {
+        uint32_t w[4];
+        memcpy(w, p, sizeof(w));
+        w[0] ^= crc;
+        crc = t[15][w[0] & 0xff] ^ t[14][(w[0] >> 8) & 0xff] ^
+                t[13][(w[0] >> 16) & 0xff] ^ t[12][w[0] >> 24] ^
+                t[11][w[1] & 0xff] ^ t[10][(w[1] >> 8) & 0xff] ^
+                t[9][(w[1] >> 16) & 0xff] ^ t[8][w[1] >> 24] ^
+                t[7][w[2] & 0xff] ^ t[6][(w[2] >> 8) & 0xff] ^
+                t[5][(w[2] >> 16) & 0xff] ^ t[4][w[2] >> 24] ^
+                t[3][w[3] & 0xff] ^ t[2][(w[3] >> 8) & 0xff] ^
+                t[1][(w[3] >> 16) & 0xff] ^ t[0][w[3] >> 24];
+    }
+# endif
+    while (len--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return ~crc;
+#endif
+}
+
+// Multiplies two bit reflected polynomials modulo the crc32 polynomial.
+static uint32_t crc32_mul(uint32_t a, uint32_t b)
+{
+    uint32_t p = 0;
+
+    for (uint32_t m = 1u << 31; m; m >>= 1) {
+        if (a & m) {
+            p ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+    return p;
+}
+
+// Returns the crc32 of two concatenated parts from the crc32 of each.
+static uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b)
+{
+    /* crc_a is shifted past len_b bytes by multiplying it by x^(8 len_b) */
+    uint32_t shift = 1u << 31;
+    uint32_t x = 1u << 23;
+
+    while (len_b) {
+        if (len_b & 1) {
+            shift = crc32_mul(shift, x);
+        }
+        x = crc32_mul(x, x);
+        len_b >>= 1;
+    }
+    return crc32_mul(crc_a, shift) ^ crc_b;
+}
+
+/**
+ * \brief       Part of the image checked by a worker
+ */
+typedef struct frogfs_crc_job_t {
+    frogfs_job_t job; /**< worker job, must be first */
+    const uint32_t (*table)[256]; /**< crc32 tables or \a NULL */
+    const uint8_t *p; /**< part start */
+    size_t len; /**< part length */
+    uint32_t crc; /**< part crc32 once done */
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    pthread_mutex_t *lock; /**< lock guarding \a pending */
+    pthread_cond_t *cond; /**< signalled when a part is done */
+    size_t *pending; /**< parts not yet done */
+#endif
+} frogfs_crc_job_t;
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+static void crc_job_run(frogfs_job_t *job)
+{
+    frogfs_crc_job_t *part = (frogfs_crc_job_t *) job;
+
+    part->crc = crc32_update(part->table, 0, part->p, part->len);
+
+    pthread_mutex_lock(part->lock);
+    (*part->pending)--;
+    pthread_cond_signal(part->cond);
+    pthread_mutex_unlock(part->lock);
+}
+#endif
+
+// Checks the image against the crc32 in its footer, splitting the work
+// between the calling thread and the workers.
+static int verify_crc(frogfs_fs_t *fs, size_t map_sz)
+{
+    const uint8_t *p = (const void *) fs->head;
+    size_t len = fs->head->bin_sz;
+    frogfs_crc_job_t *parts = NULL;
+    uint32_t (*table)[256] = NULL;
+    int ret = -1;
+
+    if (len < sizeof(frogfs_head_t) + sizeof(frogfs_foot_t) || len > map_sz) {
+        LOGE("frogfs binary length is invalid");
+        return -1;
+    }
+    len -= sizeof(frogfs_foot_t);
+    const frogfs_foot_t *foot = (const void *) (p + len);
+
+    if (CRC32_TABLE_LEN > 0) {
+        table = malloc(CRC32_TABLE_LEN * sizeof(uint32_t));
+        if (table == NULL) {
+            LOGE("malloc failed");
+            return -1;
+        }
+#if CRC32_TABLE_LEN > 0
+        crc32_init_table(table);
+#endif
+    }
+
+    size_t num_parts = frogfs_num_workers(fs) + 1;
+    if (num_parts > len / CRC32_MIN_PART) {
+        num_parts = len / CRC32_MIN_PART ? len / CRC32_MIN_PART : 1;
+    }
+    parts = calloc(num_parts, sizeof(frogfs_crc_job_t));
+    if (parts == NULL) {
+        LOGE("calloc failed");
+        goto err_out;
+    }
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    size_t pending = num_parts - 1;
+#endif
+    size_t part_len = len / num_parts;
+    for (size_t i = 0; i < num_parts; i++) {
+        parts[i].table = (const void *) table;
+        parts[i].p = p + (i * part_len);
+        parts[i].len = i == num_parts - 1 ? len - (i * part_len) : part_len;
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+        parts[i].job.run = crc_job_run;
+        parts[i].lock = &lock;
+        parts[i].cond = &cond;
+        parts[i].pending = &pending;
+        if (i > 0) {
+            frogfs_submit_job(fs, &parts[i].job);
+        }
+#endif
+    }
+
+    /* the calling thread takes the first part, then waits for the rest */
+    parts[0].crc = crc32_update(parts[0].table, 0, parts[0].p, parts[0].len);
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    pthread_mutex_lock(&lock);
+    while (pending > 0) {
+        pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&lock);
+#endif
+
+    uint32_t crc = parts[0].crc;
+    for (size_t i = 1; i < num_parts; i++) {
+        crc = crc32_combine(crc, parts[i].crc, parts[i].len);
+    }
+
+    if (crc != foot->crc32) {
+        LOGE("frogfs crc32 mismatch: %08" PRIx32 " != %08" PRIx32, crc,
+                foot->crc32);
+        goto err_out;
+    }
+    LOGV("crc32 %08" PRIx32 " ok", crc);
+    ret = 0;
+
+err_out:
+    free(parts);
+    free(table);
+    return ret;
+}
+
 frogfs_fs_t *frogfs_init(const frogfs_config_t *conf)
 {
+    size_t map_sz = SIZE_MAX;
     frogfs_fs_t *fs = calloc(1, sizeof(frogfs_fs_t));
     if (fs == NULL) {
         LOGE("calloc failed");
@@ -101,6 +773,7 @@ frogfs_fs_t *frogfs_init(const frogfs_config_t *conf)
             LOGE("mmap failed");
             goto err_out;
         }
+        map_sz = partition->size;
 #else
         LOGE("flash mmap not enabled and addr is NULL");
         goto err_out;
@@ -119,10 +792,117 @@ frogfs_fs_t *frogfs_init(const frogfs_config_t *conf)
         goto err_out;
     }
 
+    size_t head_sz = offsetof(frogfs_head_t, head_sz);
+    if (fs->head->ver_minor >= 1) {
+        head_sz = fs->head->head_sz;
+        fs->flags = fs->head->flags;
+    }
+
     fs->num_entries = fs->head->num_entries;
-    fs->hash = (const void *) fs->head + sizeof(frogfs_head_t);
+    fs->num_hashes = fs->num_entries;
+    fs->hash = (const void *) fs->head + head_sz;
     fs->root = (const void *) fs->hash + (sizeof(frogfs_hash_t) * fs->num_entries);
 
+    if (fs->flags & FROGFS_HEAD_FLAG_BTREE) {
+        fs->btree_nodes = (fs->num_entries + FROGFS_BTREE_B - 1) /
+                FROGFS_BTREE_B;
+        fs->num_hashes = fs->btree_nodes * FROGFS_BTREE_B;
+        fs->btree_keys = (const void *) fs->hash;
+        fs->btree_offs = fs->btree_keys + fs->num_hashes;
+        fs->root = (const void *) (fs->btree_offs + fs->num_hashes);
+    }
+
+    if (!(fs->flags & FROGFS_HEAD_FLAG_SORTED) && children_sorted(fs)) {
+        /* binary search the children of older images that are sorted */
+        fs->flags |= FROGFS_HEAD_FLAG_SORTED;
+    }
+
+    if (fs->flags & FROGFS_HEAD_FLAG_MPH) {
+        fs->mph = (const void *) fs->head + fs->head->mph_offs;
+    }
+
+    if (fs->flags & FROGFS_HEAD_FLAG_BLOOM) {
+        fs->bloom = (const void *) fs->head + fs->head->bloom_offs;
+    }
+
+    if (fs->flags & FROGFS_HEAD_FLAG_DICTS) {
+        fs->dicts = (const void *) fs->head + fs->head->dict_offs;
+    }
+
+    if (conf->lookup_cache_len > 0) {
+        size_t len = 1;
+        while (len < conf->lookup_cache_len) {
+            len <<= 1;
+        }
+        fs->cache = calloc(1, sizeof(frogfs_lookup_cache_t) +
+                (sizeof(frogfs_lookup_slot_t) * len));
+        if (fs->cache == NULL) {
+            LOGE("calloc failed");
+            goto err_out;
+        }
+        fs->cache->mask = len - 1;
+    }
+
+    if (conf->fh_pool_len > 0) {
+        fs->fh_pool = calloc(conf->fh_pool_len, sizeof(frogfs_fh_t));
+        fs->fh_pool_used = calloc(conf->fh_pool_len, 1);
+        if (fs->fh_pool == NULL || fs->fh_pool_used == NULL) {
+            LOGE("calloc failed");
+            goto err_out;
+        }
+        fs->fh_pool_len = conf->fh_pool_len;
+    }
+
+    if (conf->content_cache_sz > 0) {
+        fs->content_cache = calloc(1, sizeof(frogfs_content_cache_t));
+        if (fs->content_cache == NULL) {
+            LOGE("calloc failed");
+            goto err_out;
+        }
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+        pthread_mutex_init(&fs->content_cache->lock, NULL);
+#endif
+        fs->content_cache->budget = conf->content_cache_sz;
+    }
+
+    if (conf->decomp_pool_len > 0) {
+        fs->decomp_pool = calloc(conf->decomp_pool_len,
+                sizeof(frogfs_decomp_ctx_t));
+        if (fs->decomp_pool == NULL) {
+            LOGE("calloc failed");
+            goto err_out;
+        }
+        fs->decomp_pool_len = conf->decomp_pool_len;
+    }
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    if (conf->worker_threads > 0) {
+        fs->workers = calloc(conf->worker_threads, sizeof(pthread_t));
+        if (fs->workers == NULL) {
+            LOGE("calloc failed");
+            goto err_out;
+        }
+        pthread_mutex_init(&fs->job_lock, NULL);
+        pthread_cond_init(&fs->job_cond, NULL);
+        while (fs->num_workers < conf->worker_threads) {
+            if (pthread_create(&fs->workers[fs->num_workers], NULL,
+                    worker_main, fs) != 0) {
+                LOGE("pthread_create failed");
+                goto err_out;
+            }
+            fs->num_workers++;
+        }
+    }
+#else
+    if (conf->worker_threads > 0) {
+        LOGW("worker_threads needs CONFIG_FROGFS_USE_PTHREAD, ignored");
+    }
+#endif
+
+    if (conf->verify_crc && verify_crc(fs, map_sz) < 0) {
+        goto err_out;
+    }
+
     return fs;
 
 err_out:
@@ -139,70 +919,322 @@ void frogfs_deinit(frogfs_fs_t *fs)
         spi_flash_munmap(fs->mmap_handle);
     }
 #endif
+    for (size_t i = 0; i < fs->decomp_pool_len; i++) {
+        ctx_free(&fs->decomp_pool[i]);
+    }
+    free(fs->decomp_pool);
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    if (fs->workers) {
+        pthread_mutex_lock(&fs->job_lock);
+        fs->stopping = true;
+        pthread_cond_broadcast(&fs->job_cond);
+        pthread_mutex_unlock(&fs->job_lock);
+        for (size_t i = 0; i < fs->num_workers; i++) {
+            pthread_join(fs->workers[i], NULL);
+        }
+        pthread_mutex_destroy(&fs->job_lock);
+        pthread_cond_destroy(&fs->job_cond);
+        free(fs->workers);
+    }
+#endif
+    if (fs->content_cache) {
+        frogfs_content_t *c = fs->content_cache->head;
+        while (c) {
+            frogfs_content_t *next = c->next;
+            free(c);
+            c = next;
+        }
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+        pthread_mutex_destroy(&fs->content_cache->lock);
+#endif
+        free(fs->content_cache);
+    }
+    free(fs->cache);
+    free(fs->fh_pool);
+    free(fs->fh_pool_used);
     free(fs);
 }
 
-const frogfs_entry_t *frogfs_get_entry(const frogfs_fs_t *fs, const char *path)
+void frogfs_get_lookup_stats(const frogfs_fs_t *fs,
+        frogfs_lookup_stats_t *stats)
+{
+    assert(fs != NULL);
+
+    memset(stats, 0, sizeof(*stats));
+    if (fs->cache) {
+        stats->hits = __atomic_load_n(&fs->cache->hits, __ATOMIC_RELAXED);
+        stats->misses = __atomic_load_n(&fs->cache->misses,
+                __ATOMIC_RELAXED);
+    }
+}
+
+void frogfs_get_content_stats(const frogfs_fs_t *fs,
+        frogfs_content_stats_t *stats)
 {
     assert(fs != NULL);
+
+    memset(stats, 0, sizeof(*stats));
+    if (fs->content_cache) {
+        frogfs_content_cache_t *cache = fs->content_cache;
+        content_lock(cache);
+        stats->hits = cache->hits;
+        stats->misses = cache->misses;
+        stats->evictions = cache->evictions;
+        stats->bytes = cache->bytes;
+        content_unlock(cache);
+    }
+}
+
+const frogfs_entry_t *frogfs_get_entry(const frogfs_fs_t *fs, const char *path)
+{
     assert(path != NULL);
 
-    while (*path == '/') {
+    return frogfs_get_entry_n(fs, path, strlen(path));
+}
+
+const frogfs_entry_t *frogfs_get_entry_n(const frogfs_fs_t *fs,
+        const char *path, size_t len)
+{
+    assert(fs != NULL);
+    assert(path != NULL || len == 0);
+
+    while (len > 0 && *path == '/') {
         path++;
+        len--;
     }
-    LOGV("'%s'", path);
+    LOGV("'%.*s'", (int) len, path);
 
-    uint32_t hash = djb2_hash(path);
+    return frogfs_get_entry_hashed(fs, path_hash(fs, path, len), path, len);
+}
+
+uint32_t frogfs_hash_path(const frogfs_fs_t *fs, const char *path, size_t len)
+{
+    assert(fs != NULL);
+    assert(path != NULL || len == 0);
+
+    while (len > 0 && *path == '/') {
+        path++;
+        len--;
+    }
+
+    return path_hash(fs, path, len);
+}
+
+// Returns the lookup cache's entry for a path, or NULL and the slot to fill
+// once the entry is found. The slot is NULL without a cache.
+static const frogfs_entry_t *cache_find(const frogfs_fs_t *fs, uint32_t hash,
+        const char *path, size_t len, frogfs_lookup_slot_t **slot)
+{
+    if (fs->cache == NULL) {
+        *slot = NULL;
+        return NULL;
+    }
+
+    *slot = &fs->cache->slots[mph_mix(hash, 3) & fs->cache->mask];
+    const frogfs_entry_t *entry = __atomic_load_n(&(*slot)->entry,
+            __ATOMIC_RELAXED);
+    if (entry && __atomic_load_n(&(*slot)->hash, __ATOMIC_RELAXED) == hash &&
+            match_path(fs, entry, path, len)) {
+        __atomic_fetch_add(&fs->cache->hits, 1, __ATOMIC_RELAXED);
+        return entry;
+    }
+    __atomic_fetch_add(&fs->cache->misses, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Remembers a found entry in the slot returned by cache_find.
+static void cache_fill(frogfs_lookup_slot_t *slot, uint32_t hash,
+        const frogfs_entry_t *entry)
+{
+    if (slot && entry) {
+        __atomic_store_n(&slot->hash, hash, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->entry, entry, __ATOMIC_RELAXED);
+    }
+}
+
+const frogfs_entry_t *frogfs_get_entry_hashed(const frogfs_fs_t *fs,
+        uint32_t hash, const char *path, size_t len)
+{
+    assert(fs != NULL);
+    assert(path != NULL || len == 0);
+
+    while (len > 0 && *path == '/') {
+        path++;
+        len--;
+    }
     LOGV("hash %08"PRIx32, hash);
 
+    frogfs_lookup_slot_t *slot;
+    const frogfs_entry_t *entry = cache_find(fs, hash, path, len, &slot);
+    if (entry) {
+        return entry;
+    }
+
+    int index = find_hash(fs, hash, 0);
+    if (index < 0) {
+        LOGV("no match");
+        return NULL;
+    }
+
+    entry = find_entry(fs, index, hash, path, len);
+    cache_fill(slot, hash, entry);
+
+    return entry;
+}
+
+size_t frogfs_get_entries(const frogfs_fs_t *fs, const char *const paths[],
+        size_t n, const frogfs_entry_t *entries[])
+{
+    assert(fs != NULL);
+    assert(paths != NULL || n == 0);
+    assert(entries != NULL || n == 0);
+
+    size_t found = 0;
+
+    for (size_t base = 0; base < n; base += BATCH_LEN) {
+        size_t count = n - base < BATCH_LEN ? n - base : BATCH_LEN;
+        const char *path[BATCH_LEN];
+        size_t len[BATCH_LEN];
+        uint32_t hash[BATCH_LEN];
+        int index[BATCH_LEN];
+        uint8_t order[BATCH_LEN];
+        frogfs_lookup_slot_t *slot[BATCH_LEN];
+
+        /* hash every path and, unless it is cached, prefetch its first
+         * probe */
+        for (size_t i = 0; i < count; i++) {
+            path[i] = paths[base + i];
+            while (*path[i] == '/') {
+                path[i]++;
+            }
+            len[i] = strlen(path[i]);
+            hash[i] = path_hash(fs, path[i], len[i]);
+            entries[base + i] = cache_find(fs, hash[i], path[i], len[i],
+                    &slot[i]);
+            if (entries[base + i] == NULL) {
+                prefetch_probe(fs, hash[i]);
+            }
+        }
+
+        /* sort by hash so the table is searched in a single direction */
+        for (size_t i = 0; i < count; i++) {
+            size_t j = i;
+            while (j > 0 && hash[order[j - 1]] > hash[i]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+
+        /* find candidates, prefetching their entry headers */
+        int start = 0;
+        for (size_t k = 0; k < count; k++) {
+            size_t i = order[k];
+            if (entries[base + i] != NULL) {
+                index[i] = -1;
+                continue;
+            }
+            index[i] = find_hash(fs, hash[i], start);
+            if (index[i] >= 0) {
+                start = index[i];
+                PREFETCH((const void *) fs->head + hash_offs(fs, index[i]));
+            }
+        }
+
+        /* verify candidates */
+        for (size_t i = 0; i < count; i++) {
+            if (index[i] >= 0) {
+                entries[base + i] = find_entry(fs, index[i], hash[i],
+                        path[i], len[i]);
+                cache_fill(slot[i], hash[i], entries[base + i]);
+            }
+            found += entries[base + i] != NULL;
+        }
+    }
+
+    return found;
+}
+
+
+// Compares an entry's name with a path segment, like strcmp.
+static int compare_name(const frogfs_entry_t *entry, const char *seg,
+        size_t len)
+{
+    size_t n = entry->seg_sz < len ? entry->seg_sz : len;
+    int cmp = memcmp(get_name(entry), seg, n);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (entry->seg_sz > len) - (entry->seg_sz < len);
+}
+
+// Returns the child of dir named seg, or NULL.
+static const frogfs_entry_t *find_child(const frogfs_fs_t *fs,
+        const frogfs_dir_t *dir, const char *seg, size_t len)
+{
+    const frogfs_entry_t *entry;
+
+    if (!(fs->flags & FROGFS_HEAD_FLAG_SORTED)) {
+        for (int i = 0; i < dir->entry.child_count; i++) {
+            entry = (const void *) fs->head + dir->children[i];
+            if (compare_name(entry, seg, len) == 0) {
+                return entry;
+            }
+        }
+        return NULL;
+    }
+
     int first = 0;
-    int last = fs->num_entries - 1;
-    int middle;
-    const frogfs_hash_t *e;
+    int last = dir->entry.child_count - 1;
 
     while (first <= last) {
-        middle = first + (last - first) / 2;
-        e = &fs->hash[middle];
-        if (e->hash == hash) {
-            break;
-        } else if (e->hash < hash) {
+        int middle = first + (last - first) / 2;
+        entry = (const void *) fs->head + dir->children[middle];
+        int cmp = compare_name(entry, seg, len);
+        if (cmp == 0) {
+            return entry;
+        } else if (cmp < 0) {
             first = middle + 1;
         } else {
             last = middle - 1;
         }
     }
 
-    if (first > last) {
-        LOGV("no match");
-        return NULL;
-    }
+    return NULL;
+}
 
-    /* move e to the first match */
-    while (middle > 0) {
-        e = fs->hash + middle;
-        if ((e - 1)->hash != hash) {
-            break;
+const frogfs_entry_t *frogfs_get_entry_at(const frogfs_fs_t *fs,
+        const frogfs_entry_t *dir, const char *path, size_t len)
+{
+    assert(fs != NULL);
+    assert(path != NULL || len == 0);
+
+    const frogfs_entry_t *entry = dir ? dir : &fs->root->entry;
+    const char *end = path + len;
+
+    while (path < end) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+
+        const char *seg = path;
+        while (path < end && *path != '/') {
+            path++;
+        }
+
+        if (!FROGFS_IS_DIR(entry)) {
+            return NULL;
         }
-        middle--;
-    }
 
-    /* walk through canidates and look for a match */
-    const frogfs_entry_t *entry;
-    do {
-        entry = (const void *) fs->head + e->offs;
-        char *match = frogfs_get_path(fs, entry);
-        if (strcmp(path, match) == 0) {
-            free(match);
-            LOGV("entry %d", middle);
-            return entry;
+        entry = find_child(fs, (const void *) entry, seg, path - seg);
+        if (entry == NULL) {
+            LOGV("no match");
+            return NULL;
         }
-        free(match);
-        entry++;
-        middle++;
-    } while ((middle < last) && (e->hash == hash));
+    }
 
-    LOGW("unable to find entry");
-    return NULL;
+    return entry;
 }
 
 char *frogfs_get_name(const frogfs_entry_t *entry)
@@ -213,36 +1245,68 @@ char *frogfs_get_name(const frogfs_entry_t *entry)
     return name;
 }
 
-char *frogfs_get_path(const frogfs_fs_t *fs, const frogfs_entry_t *entry)
+const char *frogfs_get_name_view(const frogfs_entry_t *entry, size_t *len)
 {
     assert(entry != NULL);
+    assert(len != NULL);
+
+    *len = entry->seg_sz;
+    return get_name(entry);
+}
 
-    char *path = calloc(PATH_MAX, 1);
+// Returns the length of the entry's full path, without a terminator.
+static size_t path_len(const frogfs_fs_t *fs, const frogfs_entry_t *entry)
+{
     size_t len = 0;
-    if (!path) {
-        return NULL;
+
+    while (entry->parent != 0) {
+        len += entry->seg_sz;
+        entry = (const void *) fs->head + entry->parent;
+        if (entry->parent != 0) {
+            len++;
+        }
     }
 
-    if (entry->parent == 0) {
-        return path;
+    return len;
+}
+
+ssize_t frogfs_get_path_into(const frogfs_fs_t *fs,
+        const frogfs_entry_t *entry, char *buf, size_t buflen)
+{
+    assert(fs != NULL);
+    assert(entry != NULL);
+
+    size_t len = path_len(fs, entry);
+    if (len + 1 > buflen) {
+        return -1;
     }
 
-    while (entry->parent != 0 && len + entry->seg_sz + 1 < PATH_MAX - 1) {
-        const frogfs_entry_t *parent = (const void *) fs->head + entry->parent;
-        if ((const void *) parent == (const void *) fs->root) {
-            memmove(path + entry->seg_sz, path, len);
-            memcpy(path, get_name(entry), entry->seg_sz);
-            len += entry->seg_sz;
-            break;
-        } else {
-            memmove(path + entry->seg_sz + 1, path, len + 1);
-            path[0] = '/';
-            memcpy(path + 1, get_name(entry), entry->seg_sz);
-            len += entry->seg_sz + 1;
+    /* fill in segments from the tail */
+    char *p = buf + len;
+    *p = '\0';
+    while (entry->parent != 0) {
+        p -= entry->seg_sz;
+        memcpy(p, get_name(entry), entry->seg_sz);
+        entry = (const void *) fs->head + entry->parent;
+        if (entry->parent != 0) {
+            *--p = '/';
         }
-        entry = parent;
     }
 
+    return len;
+}
+
+char *frogfs_get_path(const frogfs_fs_t *fs, const frogfs_entry_t *entry)
+{
+    assert(entry != NULL);
+
+    size_t len = path_len(fs, entry);
+    char *path = malloc(len + 1);
+    if (!path) {
+        return NULL;
+    }
+
+    frogfs_get_path_into(fs, entry, path, len + 1);
     return path;
 }
 
@@ -280,23 +1344,297 @@ void frogfs_stat(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
     }
 }
 
-frogfs_fh_t *frogfs_open(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
-        unsigned int flags)
+// Claims a free handle from the handle pool, or returns NULL.
+static frogfs_fh_t *pool_get(const frogfs_fs_t *fs)
 {
-    assert(fs != NULL);
-    assert(entry != NULL);
+    for (size_t i = 0; i < fs->fh_pool_len; i++) {
+        if (__atomic_load_n(&fs->fh_pool_used[i], __ATOMIC_RELAXED) == 0 &&
+                __atomic_exchange_n(&fs->fh_pool_used[i], 1,
+                __ATOMIC_ACQUIRE) == 0) {
+            frogfs_fh_t *fh = &fs->fh_pool[i];
+            memset(fh, 0, sizeof(*fh));
+            fh->storage = FROGFS_FH_POOL;
+            return fh;
+        }
+    }
 
-    if (FROGFS_IS_DIR(entry)) {
+    return NULL;
+}
+
+// Claims a free decompressor context, preferring one already set up by
+// funcs, or returns NULL if every context is in use.
+static frogfs_decomp_ctx_t *ctx_get(const frogfs_fs_t *fs,
+        const frogfs_decomp_funcs_t *funcs)
+{
+    frogfs_decomp_ctx_t *spare = NULL;
+
+    for (size_t i = 0; i < fs->decomp_pool_len; i++) {
+        frogfs_decomp_ctx_t *ctx = &fs->decomp_pool[i];
+        if (__atomic_load_n(&ctx->used, __ATOMIC_RELAXED) != 0 ||
+                __atomic_exchange_n(&ctx->used, 1, __ATOMIC_ACQUIRE) != 0) {
+            continue;
+        }
+        if (ctx->priv == NULL || ctx->funcs == funcs) {
+            if (spare) {
+                __atomic_store_n(&spare->used, 0, __ATOMIC_RELEASE);
+            }
+            return ctx;
+        }
+        if (spare == NULL) {
+            spare = ctx;
+        } else {
+            __atomic_store_n(&ctx->used, 0, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (spare) {
+        /* repurpose a context set up by another decompressor */
+        ctx_free(spare);
+    }
+    return spare;
+}
+
+// Unlinks content from the cache list. Call with the lock held.
+static void content_unlink(frogfs_content_cache_t *cache, frogfs_content_t *c)
+{
+    if (c->prev) {
+        c->prev->next = c->next;
+    } else {
+        cache->head = c->next;
+    }
+    if (c->next) {
+        c->next->prev = c->prev;
+    } else {
+        cache->tail = c->prev;
+    }
+    c->prev = NULL;
+    c->next = NULL;
+}
+
+// Links content at the head of the cache list. Call with the lock held.
+static void content_link(frogfs_content_cache_t *cache, frogfs_content_t *c)
+{
+    c->prev = NULL;
+    c->next = cache->head;
+    if (cache->head) {
+        cache->head->prev = c;
+    } else {
+        cache->tail = c;
+    }
+    cache->head = c;
+}
+
+// Returns the hash bucket for file.
+static inline frogfs_content_t **content_bucket(frogfs_content_cache_t *cache,
+        const frogfs_file_t *file)
+{
+    return &cache->buckets[mph_mix((uintptr_t) file, 3) % CONTENT_BUCKETS];
+}
+
+// Removes content from the cache. Call with the lock held.
+static void content_evict(frogfs_content_cache_t *cache, frogfs_content_t *c)
+{
+    frogfs_content_t **p = content_bucket(cache, c->file);
+    while (*p != c) {
+        p = &(*p)->chain;
+    }
+    *p = c->chain;
+    content_unlink(cache, c);
+    cache->bytes -= c->len;
+    cache->evictions++;
+}
+
+// Finds cached content for file and marks it most recently used. Call with
+// the lock held.
+static frogfs_content_t *content_find(frogfs_content_cache_t *cache,
+        const frogfs_file_t *file)
+{
+    for (frogfs_content_t *c = *content_bucket(cache, file); c;
+            c = c->chain) {
+        if (c->file == file) {
+            if (c != cache->head) {
+                content_unlink(cache, c);
+                content_link(cache, c);
+            }
+            return c;
+        }
+    }
+    return NULL;
+}
+
+// Points a file handle at decompressed content, releasing its decompressor.
+static void content_use(frogfs_fh_t *fh, frogfs_content_t *c)
+{
+    if (fh->decomp_ctx) {
+        __atomic_store_n(&fh->decomp_ctx->used, 0, __ATOMIC_RELEASE);
+        fh->decomp_ctx = NULL;
+    } else if (fh->decomp_funcs->close && fh->decomp_priv) {
+        fh->decomp_funcs->close(fh);
+    }
+    fh->decomp_priv = NULL;
+    fh->decomp_funcs = &frogfs_decomp_raw;
+    fh->data_start = c->data;
+    fh->data_ptr = c->data;
+    fh->data_sz = c->len;
+    fh->content = c;
+}
+
+// Serves the handle from the content cache if the file is cached.
+static bool content_get(frogfs_fh_t *fh)
+{
+    frogfs_content_cache_t *cache = fh->fs->content_cache;
+
+    content_lock(cache);
+    frogfs_content_t *c = content_find(cache, fh->file);
+    if (c) {
+        c->refs++;
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    content_unlock(cache);
+
+    if (c) {
+        content_use(fh, c);
+    }
+    return c != NULL;
+}
+
+// Allocates empty content for the handle's file, or returns NULL if it would
+// not fit in the cache.
+static frogfs_content_t *content_alloc(frogfs_fh_t *fh)
+{
+    if (fh->real_sz > fh->fs->content_cache->budget) {
         return NULL;
     }
 
-    const frogfs_file_t *file = (const void *) entry;
+    frogfs_content_t *c = malloc(sizeof(frogfs_content_t) + fh->real_sz);
+    if (c == NULL) {
+        return NULL;
+    }
+    c->chain = NULL;
+    c->file = fh->file;
+    c->len = 0;
+    c->refs = 1;
+    c->cached = false;
+    return c;
+}
 
-    frogfs_fh_t *fh = calloc(1, sizeof(frogfs_fh_t));
-    if (fh == NULL) {
-        LOGE("calloc failed");
-        goto err_out;
+// Adds fully decompressed content to the cache and serves the handle from it,
+// at the same position. If another handle cached the file first, its copy is
+// used instead.
+static void content_add(frogfs_fh_t *fh, frogfs_content_t *c)
+{
+    frogfs_content_cache_t *cache = fh->fs->content_cache;
+    size_t pos = fh->decomp_funcs->tell(fh);
+
+    content_lock(cache);
+    frogfs_content_t *existing = content_find(cache, fh->file);
+    if (existing) {
+        /* another thread got there first */
+        existing->refs++;
+    } else {
+        frogfs_content_t *victim = cache->tail;
+        while (victim && cache->bytes + c->len > cache->budget) {
+            frogfs_content_t *prev = victim->prev;
+            if (victim->refs == 0) {
+                content_evict(cache, victim);
+                free(victim);
+            }
+            victim = prev;
+        }
+        if (cache->bytes + c->len <= cache->budget) {
+            frogfs_content_t **bucket = content_bucket(cache, c->file);
+            c->chain = *bucket;
+            *bucket = c;
+            content_link(cache, c);
+            cache->bytes += c->len;
+            c->cached = true;
+        }
+    }
+    content_unlock(cache);
+
+    if (existing) {
+        free(c);
+        c = existing;
+    }
+    content_use(fh, c);
+    fh->data_ptr += pos;
+}
+
+// Decompresses the whole file into the content cache with the decompressor's
+// read_all and serves the handle from it. The handle is rewound and left
+// untouched if that is not possible.
+static bool content_fill(frogfs_fh_t *fh)
+{
+    frogfs_content_t *c = content_alloc(fh);
+    if (c == NULL) {
+        return false;
+    }
+
+    ssize_t len = fh->decomp_funcs->read_all(fh, c->data);
+    if (len < 0 || (size_t) len != fh->real_sz) {
+        free(c);
+        fh->decomp_funcs->seek(fh, 0, SEEK_SET);
+        return false;
+    }
+    c->len = len;
+    content_add(fh, c);
+    return true;
+}
+
+// Reads from a compressed file that is not cached. A read from offset 0 that
+// covers the whole file, or any read from there on a handle opened with
+// FROGFS_OPEN_WHOLE, starts keeping a copy of the data, which goes into the
+// cache once sequential reads reach the end of the file.
+static ssize_t content_read(frogfs_fh_t *fh, void *buf, size_t len)
+{
+    if (fh->fill == NULL && fh->decomp_funcs->tell(fh) == 0 &&
+            (len >= fh->real_sz || fh->flags & FROGFS_OPEN_WHOLE)) {
+        fh->fill = content_alloc(fh);
+    }
+
+    ssize_t ret = fh->decomp_funcs->read(fh, buf, len);
+    frogfs_content_t *c = fh->fill;
+    if (c == NULL) {
+        return ret;
+    }
+    if (ret < 0) {
+        free(c);
+        fh->fill = NULL;
+        return ret;
+    }
+
+    memcpy(c->data + c->len, buf, ret);
+    c->len += ret;
+    if (c->len == fh->real_sz) {
+        fh->fill = NULL;
+        content_add(fh, c);
+    }
+    return ret;
+}
+
+// Drops a handle's reference to decompressed content.
+static void content_put(frogfs_fh_t *fh)
+{
+    frogfs_content_cache_t *cache = fh->fs->content_cache;
+    frogfs_content_t *c = fh->content;
+
+    content_lock(cache);
+    bool unused = --c->refs == 0 && !c->cached;
+    content_unlock(cache);
+
+    if (unused) {
+        free(c);
     }
+    fh->content = NULL;
+}
+
+// Sets up a zeroed file handle for entry.
+static int open_fh(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        unsigned int flags, frogfs_fh_t *fh)
+{
+    const frogfs_file_t *file = (const void *) entry;
 
     LOGV("%p", fh);
 
@@ -325,29 +1663,114 @@ frogfs_fh_t *frogfs_open(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
         fh->decomp_funcs = &frogfs_decomp_zlib;
     }
 #endif
+#if CONFIG_FROGFS_USE_MINIZ == 1 || CONFIG_FROGFS_USE_ZLIB == 1
+    else if (entry->compression == FROGFS_COMP_ALGO_BLOCK) {
+        fh->real_sz = ((frogfs_comp_t *) file)->real_sz;
+        fh->decomp_funcs = &frogfs_decomp_block;
+    }
+#endif
 #if CONFIG_FROGFS_USE_HEATSHRINK == 1
-    else if (entry->compression == FROGFS_COMP_ALGO_HEATSHRINK) {
+    else if ((entry->compression == FROGFS_COMP_ALGO_HEATSHRINK) ||
+            (entry->compression == FROGFS_COMP_ALGO_HEATSHRINK_CKPT)) {
         fh->real_sz = ((frogfs_comp_t *) file)->real_sz;
         fh->decomp_funcs = &frogfs_decomp_heatshrink;
     }
+#endif
+#if CONFIG_FROGFS_USE_ZSTD == 1
+    else if (entry->compression == FROGFS_COMP_ALGO_ZSTD) {
+        fh->real_sz = ((frogfs_comp_t *) file)->real_sz;
+        fh->decomp_funcs = &frogfs_decomp_zstd;
+    }
+#endif
+#if CONFIG_FROGFS_USE_LZ4 == 1
+    else if (entry->compression == FROGFS_COMP_ALGO_LZ4) {
+        fh->real_sz = ((frogfs_comp_t *) file)->real_sz;
+        fh->decomp_funcs = &frogfs_decomp_lz4;
+    }
 #endif
     else {
         LOGE("unsupported compression type %d", entry->compression)
-        goto err_out;
+        return -1;
+    }
+
+    if (fh->decomp_funcs != &frogfs_decomp_raw && fs->content_cache &&
+            content_get(fh)) {
+        return 0;
+    }
+
+    if (fh->decomp_funcs != &frogfs_decomp_raw && fs->decomp_pool_len > 0) {
+        fh->decomp_ctx = ctx_get(fs, fh->decomp_funcs);
+        if (fh->decomp_ctx == NULL) {
+            LOGE("no free decompressor context");
+            return -1;
+        }
+        fh->decomp_priv = fh->decomp_ctx->priv;
     }
 
     if (fh->decomp_funcs->open) {
-        if (fh->decomp_funcs->open(fh, flags) < 0) {
+        int ret = fh->decomp_funcs->open(fh, flags);
+        if (fh->decomp_ctx) {
+            fh->decomp_ctx->funcs = fh->decomp_funcs;
+            fh->decomp_ctx->priv = fh->decomp_priv;
+        }
+        if (ret < 0) {
             LOGE("decomp_funcs->fopen");
-            goto err_out;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+frogfs_fh_t *frogfs_open(const frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        unsigned int flags)
+{
+    assert(fs != NULL);
+    assert(entry != NULL);
+
+    if (FROGFS_IS_DIR(entry)) {
+        return NULL;
+    }
+
+    frogfs_fh_t *fh = pool_get(fs);
+    if (fh == NULL) {
+        fh = calloc(1, sizeof(frogfs_fh_t));
+        if (fh == NULL) {
+            LOGE("calloc failed");
+            return NULL;
         }
     }
 
+    if (open_fh(fs, entry, flags, fh) < 0) {
+        frogfs_close(fh);
+        return NULL;
+    }
+
     return fh;
+}
 
-err_out:
-    frogfs_close(fh);
-    return NULL;
+frogfs_fh_t *frogfs_open_into(const frogfs_fs_t *fs,
+        const frogfs_entry_t *entry, unsigned int flags,
+        frogfs_fh_storage_t *storage)
+{
+    assert(fs != NULL);
+    assert(entry != NULL);
+    assert(storage != NULL);
+
+    if (FROGFS_IS_DIR(entry)) {
+        return NULL;
+    }
+
+    frogfs_fh_t *fh = (frogfs_fh_t *) storage;
+    memset(fh, 0, sizeof(*fh));
+    fh->storage = FROGFS_FH_USER;
+
+    if (open_fh(fs, entry, flags, fh) < 0) {
+        frogfs_close(fh);
+        return NULL;
+    }
+
+    return fh;
 }
 
 void frogfs_close(frogfs_fh_t *fh)
@@ -357,13 +1780,112 @@ void frogfs_close(frogfs_fh_t *fh)
         return;
     }
 
-    if (fh->decomp_funcs && fh->decomp_funcs->close) {
+    if (fh->decomp_ctx) {
+        __atomic_store_n(&fh->decomp_ctx->used, 0, __ATOMIC_RELEASE);
+    } else if (fh->decomp_funcs && fh->decomp_funcs->close) {
         fh->decomp_funcs->close(fh);
     }
 
+    if (fh->content) {
+        content_put(fh);
+    }
+    free(fh->fill);
+
     LOGV("%p", fh);
 
-    free(fh);
+    if (fh->storage == FROGFS_FH_POOL) {
+        __atomic_store_n(&fh->fs->fh_pool_used[fh - fh->fs->fh_pool], 0,
+                __ATOMIC_RELEASE);
+    } else if (fh->storage == FROGFS_FH_HEAP) {
+        free(fh);
+    }
+}
+
+size_t frogfs_num_workers(const frogfs_fs_t *fs)
+{
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+    return fs->num_workers;
+#else
+    (void) fs;
+    return 0;
+#endif
+}
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+void frogfs_submit_job(const frogfs_fs_t *fs, frogfs_job_t *job)
+{
+    frogfs_fs_t *mfs = (frogfs_fs_t *) fs;
+
+    job->next = NULL;
+    pthread_mutex_lock(&mfs->job_lock);
+    if (mfs->job_tail) {
+        mfs->job_tail->next = job;
+    } else {
+        mfs->job_head = job;
+    }
+    mfs->job_tail = job;
+    pthread_cond_signal(&mfs->job_cond);
+    pthread_mutex_unlock(&mfs->job_lock);
+}
+#endif
+
+const frogfs_ckpt_t *frogfs_find_ckpt(const frogfs_fh_t *f, size_t offs,
+        const void **window)
+{
+    const frogfs_entry_t *entry = &f->file->entry;
+    if (entry->compression == FROGFS_COMP_ALGO_HEATSHRINK) {
+        /* all opts bits are heatshrink parameters */
+        return NULL;
+    }
+    if (entry->compression != FROGFS_COMP_ALGO_HEATSHRINK_CKPT &&
+            !(entry->opts & FROGFS_COMP_OPT_CKPT)) {
+        return NULL;
+    }
+
+    const frogfs_ckpts_t *index = f->data_start + align(f->data_sz);
+    const frogfs_ckpt_t *ckpt = NULL;
+    uint32_t first = 0;
+    uint32_t last = index->num_ckpts;
+
+    while (first < last) {
+        uint32_t middle = first + ((last - first) / 2);
+        if (index->ckpts[middle].out_offs <= offs) {
+            ckpt = &index->ckpts[middle];
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+
+    if (ckpt) {
+        *window = (const void *) index + ckpt->window_offs;
+    }
+    return ckpt;
+}
+
+const void *frogfs_find_dict(const frogfs_fs_t *fs, uint32_t id, size_t *len)
+{
+    if (fs->dicts == NULL) {
+        return NULL;
+    }
+
+    uint32_t first = 0;
+    uint32_t last = fs->dicts->num_dicts;
+
+    while (first < last) {
+        uint32_t middle = first + ((last - first) / 2);
+        const frogfs_dict_t *dict = &fs->dicts->dicts[middle];
+        if (dict->id == id) {
+            *len = dict->len;
+            return (const void *) fs->dicts + dict->offs;
+        } else if (dict->id < id) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+
+    return NULL;
 }
 
 int frogfs_is_raw(frogfs_fh_t *fh)
@@ -375,22 +1897,79 @@ ssize_t frogfs_read(frogfs_fh_t *fh, void *buf, size_t len)
 {
     assert(fh != NULL);
 
-    if (fh->decomp_funcs->read) {
-        return fh->decomp_funcs->read(fh, buf, len);
+    if (fh->decomp_funcs->read == NULL) {
+        return -1;
     }
 
-    return -1;
+    if (fh->fs->content_cache && fh->decomp_funcs != &frogfs_decomp_raw) {
+        return content_read(fh, buf, len);
+    }
+
+    return fh->decomp_funcs->read(fh, buf, len);
+}
+
+ssize_t frogfs_read_all(frogfs_fh_t *fh, void *buf, size_t cap)
+{
+    assert(fh != NULL);
+
+    if (fh->decomp_funcs->read_all && cap >= fh->real_sz &&
+            frogfs_tell(fh) == 0) {
+        if (fh->fs->content_cache && content_fill(fh)) {
+            memcpy(buf, fh->data_start, fh->data_sz);
+            return fh->data_sz;
+        }
+        return fh->decomp_funcs->read_all(fh, buf);
+    }
+
+    size_t len = 0;
+    while (len < cap) {
+        ssize_t ret = frogfs_read(fh, buf + len, cap - len);
+        if (ret < 0) {
+            return -1;
+        }
+        if (ret == 0) {
+            break;
+        }
+        len += ret;
+    }
+    return len;
+}
+
+ssize_t frogfs_read_span(frogfs_fh_t *fh, size_t len, const void **ptr)
+{
+    assert(fh != NULL);
+    assert(ptr != NULL);
+
+    if (fh->decomp_funcs != &frogfs_decomp_raw) {
+        return -1;
+    }
+
+    size_t pos = fh->data_ptr - fh->data_start;
+    size_t remaining = pos < fh->data_sz ? fh->data_sz - pos : 0;
+    if (len > remaining) {
+        len = remaining;
+    }
+
+    *ptr = fh->data_ptr;
+    fh->data_ptr += len;
+    return len;
 }
 
 ssize_t frogfs_seek(frogfs_fh_t *fh, long offset, int mode)
 {
     assert(fh != NULL);
 
-    if (fh->decomp_funcs->seek) {
-        return fh->decomp_funcs->seek(fh, offset, mode);
+    if (fh->decomp_funcs->seek == NULL) {
+        return -1;
     }
 
-    return -1;
+    ssize_t ret = fh->decomp_funcs->seek(fh, offset, mode);
+    if (fh->fill && (ret < 0 || (size_t) ret != fh->fill->len)) {
+        /* no longer reading sequentially */
+        free(fh->fill);
+        fh->fill = NULL;
+    }
+    return ret;
 }
 
 size_t frogfs_tell(frogfs_fh_t *fh)
@@ -17,10 +17,30 @@
 #define CONFIG_FROGFS_USE_ZLIB 0
 #endif
 
+#if !defined(CONFIG_FROGFS_USE_LIBDEFLATE)
+#define CONFIG_FROGFS_USE_LIBDEFLATE 0
+#endif
+
 #if !defined(CONFIG_FROGFS_USE_HEATSHRINK)
 #define CONFIG_FROGFS_USE_HEATSHRINK 0
 #endif
 
+#if !defined(CONFIG_FROGFS_HEATSHRINK_BUFFER_LEN)
+#define CONFIG_FROGFS_HEATSHRINK_BUFFER_LEN 16
+#endif
+
+#if !defined(CONFIG_FROGFS_USE_ZSTD)
+#define CONFIG_FROGFS_USE_ZSTD 0
+#endif
+
+#if !defined(CONFIG_FROGFS_USE_LZ4)
+#define CONFIG_FROGFS_USE_LZ4 0
+#endif
+
+#if !defined(CONFIG_FROGFS_USE_PTHREAD)
+#define CONFIG_FROGFS_USE_PTHREAD 0
+#endif
+
 #if !defined(CONFIG_FROGFS_LOG_LEVEL_NONE) || \
     !defined(CONFIG_FROGFS_LOG_LEVEL_ERROR) || \
     !defined(CONFIG_FROGFS_LOG_LEVEL_WARN) || \
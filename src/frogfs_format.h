@@ -22,6 +22,58 @@
  */
 #define FROGFS_IS_COMP(e) (e->child_count > 0xFF00)
 
+/**
+ * \brief       Header flag for a minimal perfect hash section
+ */
+#define FROGFS_HEAD_FLAG_MPH (1 << 0)
+
+/**
+ * \brief       Header flag for a seeded 64-bit path hash
+ */
+#define FROGFS_HEAD_FLAG_HASH64 (1 << 1)
+
+/**
+ * \brief       Header flag for a B-tree ordered hash table with separate hash
+ *              and offset arrays
+ */
+#define FROGFS_HEAD_FLAG_BTREE (1 << 2)
+
+/**
+ * \brief       Header flag for a bloom filter section
+ */
+#define FROGFS_HEAD_FLAG_BLOOM (1 << 3)
+
+/**
+ * \brief       Header flag for directory children sorted by name
+ */
+#define FROGFS_HEAD_FLAG_SORTED (1 << 4)
+
+/**
+ * \brief       Header flag for a shared deflate dictionary section
+ */
+#define FROGFS_HEAD_FLAG_DICTS (1 << 5)
+
+/**
+ * \brief       Deflate compression opts flag for a seek checkpoint index
+ *              following the aligned compressed data
+ */
+#define FROGFS_COMP_OPT_CKPT (1 << 7)
+
+/**
+ * \brief       Deflate window size, saved with each seek checkpoint
+ */
+#define FROGFS_CKPT_WINDOW 32768
+
+/**
+ * \brief       Number of hashes in a B-tree node, one 64 byte cache line
+ */
+#define FROGFS_BTREE_B 16
+
+/**
+ * \brief       Hash of B-tree padding slots, which no entry may have
+ */
+#define FROGFS_BTREE_PAD 0xFFFFFFFF
+
 /**
  * \brief       Filesystem header
  */
@@ -31,16 +83,65 @@ typedef struct __attribute__((packed)) frogfs_head_t {
     uint8_t ver_minor; /**< minor version */
     uint16_t num_entries; /** entry count */
     uint32_t bin_sz; /**< binary length */
+    uint16_t head_sz; /**< header size (v1.1+) */
+    uint16_t flags; /**< feature flags (v1.1+) */
+    uint32_t mph_offs; /**< minimal perfect hash offset (v1.1+) */
+    uint32_t hash_seed; /**< 64-bit path hash seed (v1.1+) */
+    uint32_t bloom_offs; /**< bloom filter offset (v1.1+) */
+    uint32_t dict_offs; /**< dictionary section offset (v1.1+) */
 } frogfs_head_t;
 
 /**
  * \brief       Hash table entry
  */
 typedef struct __attribute__((packed)) frogfs_hash_t {
-    uint32_t hash; /**< path hash */
+    uint32_t hash; /**< path hash, 64-bit hashes are folded to 32 bits */
     uint32_t offs; /**< object offset */
 } frogfs_hash_t;
 
+/**
+ * \brief       Minimal perfect hash section header
+ *
+ * Followed by \a num_buckets displacements and \a num_slots hash table
+ * indexes. A displacement with the high bit set is a direct slot index,
+ * otherwise it is a seed for the slot hash.
+ */
+typedef struct __attribute__((packed)) frogfs_mph_t {
+    uint32_t num_buckets; /**< displacement count */
+    uint32_t num_slots; /**< slot count */
+    uint32_t disp[]; /**< bucket displacements */
+} frogfs_mph_t;
+
+/**
+ * \brief       Bloom filter section header
+ *
+ * Each path hash selects one 512-bit block and sets \a num_hashes bits
+ * within it, so a lookup touches at most two cache lines.
+ */
+typedef struct __attribute__((packed)) frogfs_bloom_t {
+    uint32_t num_blocks; /**< 512-bit block count */
+    uint8_t num_hashes; /**< bits set per path */
+    uint8_t _reserved[3];
+    uint32_t words[]; /**< filter bits */
+} frogfs_bloom_t;
+
+/**
+ * \brief       Shared deflate dictionary
+ */
+typedef struct __attribute__((packed)) frogfs_dict_t {
+    uint32_t id; /**< adler32 of the dictionary, as in the zlib header */
+    uint32_t offs; /**< data offset from the section start */
+    uint32_t len; /**< data length, at most \a FROGFS_CKPT_WINDOW */
+} frogfs_dict_t;
+
+/**
+ * \brief       Dictionary section header, ordered by id
+ */
+typedef struct __attribute__((packed)) frogfs_dicts_t {
+    uint32_t num_dicts; /**< dictionary count */
+    frogfs_dict_t dicts[]; /**< dictionaries */
+} frogfs_dicts_t;
+
 /**
  * \brief       Entry header
  */
@@ -84,6 +185,40 @@ typedef struct __attribute__((packed)) frogfs_comp_t {
     uint32_t real_sz; /**< expanded size */
 } frogfs_comp_t;
 
+/**
+ * \brief       Deflate seek checkpoint
+ *
+ * Checkpoints sit at sync flush points, so the next block starts on a byte
+ * boundary. The window is the min(\a out_offs, \a FROGFS_CKPT_WINDOW)
+ * bytes of output preceding the checkpoint.
+ */
+typedef struct __attribute__((packed)) frogfs_ckpt_t {
+    uint32_t out_offs; /**< uncompressed offset */
+    uint32_t in_offs; /**< compressed offset */
+    uint32_t window_offs; /**< window offset from the index start */
+} frogfs_ckpt_t;
+
+/**
+ * \brief       Heatshrink seek checkpoint window
+ *
+ * A heatshrink bitstream of \a num_lits literals that rebuilds the decoder
+ * window, ending with the unread bits of the byte before the checkpoint's
+ * \a in_offs, so that decoding continues there on a byte boundary.
+ */
+typedef struct __attribute__((packed)) frogfs_hs_window_t {
+    uint16_t num_lits; /**< literals to decode and discard */
+    uint16_t len; /**< bitstream length */
+    uint8_t bits[]; /**< bitstream */
+} frogfs_hs_window_t;
+
+/**
+ * \brief       Deflate seek checkpoint index, ordered by offset
+ */
+typedef struct __attribute__((packed)) frogfs_ckpts_t {
+    uint32_t num_ckpts; /**< checkpoint count */
+    frogfs_ckpt_t ckpts[]; /**< checkpoints */
+} frogfs_ckpts_t;
+
 /**
  * \brief       Filesystem footer
  */
@@ -14,6 +14,25 @@
 
 typedef struct frogfs_fs_t frogfs_fs_t;
 typedef struct frogfs_decomp_funcs_t frogfs_decomp_funcs_t;
+typedef struct frogfs_content_t frogfs_content_t;
+
+/**
+ * \brief       Where a file handle's storage came from
+ */
+typedef enum frogfs_fh_storage_type_t {
+    FROGFS_FH_HEAP, /**< allocated by \a frogfs_open */
+    FROGFS_FH_POOL, /**< claimed from the fs handle pool */
+    FROGFS_FH_USER, /**< provided to \a frogfs_open_into */
+} frogfs_fh_storage_type_t;
+
+/**
+ * \brief       Pooled decompressor context
+ */
+typedef struct frogfs_decomp_ctx_t {
+    const frogfs_decomp_funcs_t *funcs; /**< decompressor owning priv */
+    void *priv; /**< decompressor private data or NULL */
+    uint8_t used; /**< context is in use */
+} frogfs_decomp_ctx_t;
 
 /**
  * \brief       Structure describing a frogfs file entry
@@ -28,6 +47,10 @@ typedef struct frogfs_fh_t {
     unsigned int flags; /** open flags */
     const frogfs_decomp_funcs_t *decomp_funcs; /**< decompresor funcs */
     void *decomp_priv; /**< decompressor private data */
+    frogfs_decomp_ctx_t *decomp_ctx; /**< pooled context or NULL */
+    frogfs_content_t *content; /**< decompressed content or NULL */
+    frogfs_content_t *fill; /**< content being read sequentially or NULL */
+    frogfs_fh_storage_type_t storage; /**< handle storage type */
 } frogfs_fh_t;
 
 /**
@@ -41,6 +64,17 @@ typedef struct frogfs_dh_t {
 
 /**
  * \brief       Structure of function pointers that describe a decompressor
+ *
+ * If \a decomp_priv is not \a NULL when \a open is called, it is a pooled
+ * context previously set up by the same decompressor and must be reset
+ * rather than allocated. \a open leaves \a decomp_priv either \a NULL or
+ * pointing at a context that \a close can free, even on error.
+ *
+ * The optional \a read_all decodes a whole file from offset 0 into a buffer
+ * of at least \a real_sz bytes in one call, leaving the handle at the end.
+ *
+ * The optional \a skip decodes and discards the next \a len bytes, returning
+ * how many were skipped, which is fewer only at the end of the file.
  */
 typedef struct frogfs_decomp_funcs_t {
     int (*open)(frogfs_fh_t *f, unsigned int flags);
@@ -48,8 +82,75 @@ typedef struct frogfs_decomp_funcs_t {
     ssize_t (*read)(frogfs_fh_t *f, void *buf, size_t len);
     ssize_t (*seek)(frogfs_fh_t *f, long offset, int mode);
     size_t (*tell)(frogfs_fh_t *f);
+    ssize_t (*read_all)(frogfs_fh_t *f, void *buf);
+    ssize_t (*skip)(frogfs_fh_t *f, size_t len);
 } frogfs_decomp_funcs_t;
 
+/**
+ * \brief       Job run by the fs decompression workers
+ */
+typedef struct frogfs_job_t {
+    struct frogfs_job_t *next; /**< next queued job */
+    void (*run)(struct frogfs_job_t *job); /**< job function */
+} frogfs_job_t;
+
+/**
+ * \brief       Get the number of decompression worker threads
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \return              worker thread count, 0 if disabled
+ */
+size_t frogfs_num_workers(const frogfs_fs_t *fs);
+
+#if CONFIG_FROGFS_USE_PTHREAD == 1
+/**
+ * \brief       Queue a job for the decompression workers
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   job     \a frogfs_job_t pointer, must stay valid until the
+ *                      job has run
+ */
+void frogfs_submit_job(const frogfs_fs_t *fs, frogfs_job_t *job);
+#endif
+
+/**
+ * \brief       Find the last seek checkpoint at or before an offset
+ * \param[in]   f       \a frogfs_fh_t pointer
+ * \param[in]   offs    uncompressed offset
+ * \param[out]  window  set to the checkpoint's window
+ * \return              \a frogfs_ckpt_t pointer or \a NULL if the file has
+ *                      no checkpoint before offs
+ */
+const frogfs_ckpt_t *frogfs_find_ckpt(const frogfs_fh_t *f, size_t offs,
+        const void **window);
+
+/**
+ * \brief       Find a shared deflate dictionary
+ * \param[in]   fs      \a frogfs_fs_t pointer
+ * \param[in]   id      dictionary id from the zlib header
+ * \param[out]  len     set to the dictionary length
+ * \return              dictionary pointer or \a NULL if not found
+ */
+const void *frogfs_find_dict(const frogfs_fs_t *fs, uint32_t id, size_t *len);
+
+struct libdeflate_decompressor;
+
+/**
+ * \brief       Inflate a whole zlib, gzip or raw deflate file with libdeflate
+ * \param[in]   f       \a frogfs_fh_t pointer
+ * \param[out]  buf     buffer of at least \a real_sz bytes
+ * \param[in,out] d     decompressor kept in the decompressor's private
+ *                      data, allocated on first use if \a NULL
+ * \return              0 on success, < 0 if the file could not be decoded
+ *                      this way and should be streamed instead
+ */
+int frogfs_inflate_all(frogfs_fh_t *f, void *buf,
+        struct libdeflate_decompressor **d);
+
+/**
+ * \brief       Free a decompressor allocated by \a frogfs_inflate_all
+ * \param[in]   d       decompressor or \a NULL
+ */
+void frogfs_inflate_free(struct libdeflate_decompressor *d);
+
 /**
  * \brief       Raw decompressor functions
  */
@@ -70,4 +171,22 @@ extern const frogfs_decomp_funcs_t frogfs_decomp_miniz;
  */
 extern const frogfs_decomp_funcs_t frogfs_decomp_zlib;
 
+/**
+ * \brief       Block deflate decompressor functions
+ */
+extern const frogfs_decomp_funcs_t frogfs_decomp_block;
+
+/**
+ * \brief       Zstandard decompressor functions
+ */
+extern const frogfs_decomp_funcs_t frogfs_decomp_zstd;
+
+/**
+ * \brief       LZ4 frame decompressor functions
+ */
+extern const frogfs_decomp_funcs_t frogfs_decomp_lz4;
+
 #include "frogfs/frogfs.h"
+
+_Static_assert(sizeof(frogfs_fh_t) <= sizeof(frogfs_fh_storage_t),
+        "frogfs_fh_storage_t is too small");
@@ -212,9 +212,13 @@ static int frogfs_vfs_readdir_r(void *ctx, DIR *pdir, struct dirent *ent,
     }
 
     ent->d_ino = frogfs_telldir(dh->dh);
-    const char *name = frogfs_get_name(entry);
-    strlcpy(ent->d_name, name, sizeof(ent->d_name));
-    free((void *) name);
+    size_t len;
+    const char *name = frogfs_get_name_view(entry, &len);
+    if (len > sizeof(ent->d_name) - 1) {
+        len = sizeof(ent->d_name) - 1;
+    }
+    memcpy(ent->d_name, name, len);
+    ent->d_name[len] = '\0';
     ent->d_type = DT_UNKNOWN;
     if (frogfs_is_dir(entry)) {
         ent->d_type = DT_DIR;
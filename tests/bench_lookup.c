@@ -0,0 +1,188 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Path lookup microbenchmark, one line per image:
+ *
+ *     bench_lookup IMAGE...
+ *
+ * hit and miss are frogfs_get_entry times for every path in the image and
+ * for the same paths with a suffix. verify is the check that lookups did
+ * for each hash candidate before paths were matched in place: build the
+ * candidate's path in a PATH_MAX buffer and strcmp it, timed on its own on
+ * already resolved entries. The allocs columns count heap allocations per
+ * lookup and per verify, when the linker can wrap malloc. Comparing images
+ * built with and without the hash-btree option gives the B-tree against the
+ * flat table. */
+
+#include <limits.h>
+#include <time.h>
+
+#include "common.h"
+
+
+#ifndef PATH_MAX
+# define PATH_MAX 256
+#endif
+
+#define MIN_NS 200000000
+
+static volatile uintptr_t sink;
+
+#if defined(BENCH_WRAP_ALLOC)
+static size_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    allocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocs++;
+    return __real_realloc(ptr, size);
+}
+#else
+static const size_t allocs;
+#endif
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef struct {
+    char **paths;
+    char **misses;
+    const frogfs_entry_t **entries;
+    size_t len;
+} paths_t;
+
+typedef struct {
+    double ns; /* nanoseconds per call */
+    double allocs; /* heap allocations per call */
+} result_t;
+
+static void add_path(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, void *arg)
+{
+    paths_t *paths = arg;
+    size_t len = strlen(path);
+
+    if (!frogfs_is_file(entry)) {
+        return;
+    }
+
+    paths->paths = realloc(paths->paths, (paths->len + 1) * sizeof(char *));
+    paths->misses = realloc(paths->misses,
+            (paths->len + 1) * sizeof(char *));
+    paths->entries = realloc(paths->entries,
+            (paths->len + 1) * sizeof(frogfs_entry_t *));
+    paths->paths[paths->len] = strdup(path);
+    paths->misses[paths->len] = malloc(len + 2);
+    memcpy(paths->misses[paths->len], path, len);
+    memcpy(paths->misses[paths->len] + len, "~", 2);
+    paths->entries[paths->len] = entry;
+    paths->len++;
+}
+
+// Times lookups of paths.
+static result_t time_lookups(frogfs_fs_t *fs, char **paths, size_t len)
+{
+    size_t start_allocs = allocs, n = 0;
+    uint64_t start = now_ns(), elapsed;
+
+    do {
+        for (size_t i = 0; i < len; i++) {
+            sink += (uintptr_t) frogfs_get_entry(fs, paths[i]);
+        }
+        n += len;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_NS);
+
+    return (result_t) {
+        .ns = (double) elapsed / n,
+        .allocs = (double) (allocs - start_allocs) / n,
+    };
+}
+
+// Times the build-and-compare verification of resolved entries.
+static result_t time_verify(frogfs_fs_t *fs, paths_t *paths)
+{
+    size_t start_allocs = allocs, n = 0;
+    uint64_t start = now_ns(), elapsed;
+
+    do {
+        for (size_t i = 0; i < paths->len; i++) {
+            char *path = calloc(1, PATH_MAX);
+            frogfs_get_path_into(fs, paths->entries[i], path, PATH_MAX);
+            sink += strcmp(path, paths->paths[i]) == 0;
+            free(path);
+        }
+        n += paths->len;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_NS);
+
+    return (result_t) {
+        .ns = (double) elapsed / n,
+        .allocs = (double) (allocs - start_allocs) / n,
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s IMAGE...\n", argv[0]);
+        return 2;
+    }
+
+    printf("%-16s %6s %8s %8s %8s %8s %10s %8s\n", "image", "files",
+            "hit ns", "allocs", "miss ns", "allocs", "verify ns", "allocs");
+
+    for (int i = 1; i < argc; i++) {
+        size_t len;
+        void *image = load_file(argv[i], &len);
+        frogfs_config_t conf = { .addr = image };
+        frogfs_fs_t *fs = frogfs_init(&conf);
+        if (fs == NULL) {
+            fprintf(stderr, "%s: frogfs_init failed\n", argv[i]);
+            return 1;
+        }
+
+        paths_t paths = {0};
+        walk(fs, frogfs_get_entry(fs, ""), add_path, &paths);
+
+        result_t hit = time_lookups(fs, paths.paths, paths.len);
+        result_t miss = time_lookups(fs, paths.misses, paths.len);
+        result_t verify = time_verify(fs, &paths);
+        const char *name = strrchr(argv[i], '/');
+        printf("%-16s %6zu %8.1f %8.2f %8.1f %8.2f %10.1f %8.2f\n",
+                name ? name + 1 : argv[i], paths.len, hit.ns, hit.allocs,
+                miss.ns, miss.allocs, verify.ns, verify.allocs);
+
+        for (size_t j = 0; j < paths.len; j++) {
+            free(paths.paths[j]);
+            free(paths.misses[j]);
+        }
+        free(paths.paths);
+        free(paths.misses);
+        free(paths.entries);
+        frogfs_deinit(fs);
+        free(image);
+    }
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frogfs/frogfs.h"
+
+
+static int failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, \
+                    __LINE__, #cond); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            failures++; \
+        } \
+    } while (0)
+
+// Reads a whole file into a malloc'd buffer, or exits.
+static inline void *load_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(2);
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    void *buf = malloc(*len + 1);
+    if (buf == NULL || fread(buf, 1, *len, f) != *len) {
+        perror(path);
+        exit(2);
+    }
+    fclose(f);
+    return buf;
+}
+
+typedef void (*walk_cb_t)(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, void *arg);
+
+// Calls cb for every entry below dir, depth first.
+static inline void walk(frogfs_fs_t *fs, const frogfs_entry_t *dir,
+        walk_cb_t cb, void *arg)
+{
+    frogfs_dh_t *dh = frogfs_opendir(fs, dir);
+    const frogfs_entry_t *entry;
+
+    while ((entry = frogfs_readdir(dh)) != NULL) {
+        char *path = frogfs_get_path(fs, entry);
+        cb(fs, entry, path, arg);
+        free(path);
+        if (frogfs_is_dir(entry)) {
+            walk(fs, entry, cb, arg);
+        }
+    }
+    frogfs_closedir(dh);
+}
+
+// Returns a pseudo random number, for repeatable test sequences.
+static inline uint32_t xorshift(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
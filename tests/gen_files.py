@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+'''Generate the deterministic file tree that the test images are built from'''
+
+import os
+import random
+import sys
+
+WORDS = ('frog', 'pond', 'lily', 'pad', 'jump', 'green', 'water', 'fly',
+         'tongue', 'croak', 'swamp', 'reed', 'moss', 'stone', 'ripple',
+         'tadpole', 'night', 'song', 'leaf', 'mud')
+
+def text(rng: random.Random, size: int) -> bytes:
+    '''Compressible text of size bytes'''
+    lines = []
+    length = 0
+    while length < size:
+        line = ' '.join(rng.choice(WORDS) for _ in range(rng.randint(4, 14)))
+        line = f'{len(lines):06d} {line}\n'
+        lines.append(line)
+        length += len(line)
+    return ''.join(lines).encode()[:size]
+
+def script(rng: random.Random, i: int) -> bytes:
+    '''Small script sharing most of its text with its siblings'''
+    body = ''.join(f'    exports.{rng.choice(WORDS)}{n} = function () '
+                   f'{{ return "{rng.choice(WORDS)}"; }};\n'
+                   for n in range(rng.randint(4, 12)))
+    return (f'/* chunk {i} */\n(function (exports) {{\n"use strict";\n'
+            f'{body}}})(window.frogfs = window.frogfs || {{}});\n').encode()
+
+def main() -> None:
+    out = sys.argv[1]
+    rng = random.Random(1)
+
+    def write(path: str, data: bytes) -> None:
+        path = os.path.join(out, path)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, 'wb') as f:
+            f.write(data)
+
+    write('index.html', b'<!DOCTYPE html>\n<p>hello frogfs</p>\n')
+    write('empty.txt', b'')
+    write('random.bin', bytes(rng.getrandbits(8) for _ in range(65536)))
+    write('sub/big.txt', text(rng, 200000))
+    write('sub/deep/f.txt', b'deep\n')
+    write('logs/server.log', text(rng, 1200000))
+    for i in range(1, 51):
+        write(f'static/chunk-{i}.js', script(rng, i))
+    for d in range(16):
+        for f in range(64):
+            write(f'many/d{d}/f{f}.txt', f'{d} {f}\n'.encode())
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,233 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Path lookups against every entry of an image:
+ *
+ *     test_lookup IMAGE
+ */
+
+#include "common.h"
+
+
+/* hashes to 0xFFFFFFFF with the 64-bit hash and seed 0, the key of the
+ * B-tree padding slots */
+#define PAD_PATH "zz5cde7fba30"
+
+typedef struct {
+    const char **paths;
+    const frogfs_entry_t **entries;
+    size_t len;
+    size_t cap;
+} paths_t;
+
+static void check_entry(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, void *arg)
+{
+    paths_t *paths = arg;
+    size_t len = strlen(path);
+    char buf[256];
+
+    CHECK(frogfs_get_entry(fs, path) == entry, "%s", path);
+
+    snprintf(buf, sizeof(buf), "/%s", path);
+    CHECK(frogfs_get_entry(fs, buf) == entry, "%s", buf);
+
+    /* length delimited, as in a request line */
+    snprintf(buf, sizeof(buf), "%s HTTP/1.1", path);
+    CHECK(frogfs_get_entry_n(fs, buf, len) == entry, "%s", path);
+
+    uint32_t hash = frogfs_hash_path(fs, path, len);
+    CHECK(frogfs_get_entry_hashed(fs, hash, path, len) == entry, "%s", path);
+    CHECK(frogfs_get_entry_at(fs, NULL, path, len) == entry, "%s", path);
+
+    const char *slash = strrchr(path, '/');
+    if (slash) {
+        const frogfs_entry_t *parent = frogfs_get_entry_n(fs, path,
+                slash - path);
+        CHECK(frogfs_get_entry_at(fs, parent, slash + 1,
+                strlen(slash + 1)) == entry, "%s", path);
+    }
+
+    snprintf(buf, sizeof(buf), "%s~", path);
+    CHECK(frogfs_get_entry(fs, buf) == NULL, "%s", buf);
+
+    size_t name_len;
+    const char *name = frogfs_get_name_view(entry, &name_len);
+    const char *base = slash ? slash + 1 : path;
+    CHECK(name_len == strlen(base) && memcmp(name, base, name_len) == 0,
+            "%s", path);
+
+    if (paths->len == paths->cap) {
+        paths->cap = paths->cap ? paths->cap * 2 : 256;
+        paths->paths = realloc(paths->paths, paths->cap * sizeof(char *));
+        paths->entries = realloc(paths->entries,
+                paths->cap * sizeof(frogfs_entry_t *));
+    }
+    paths->paths[paths->len] = strdup(path);
+    paths->entries[paths->len] = entry;
+    paths->len++;
+}
+
+static void check_batch(frogfs_fs_t *fs, paths_t *paths)
+{
+    const frogfs_entry_t **found = malloc(paths->len *
+            sizeof(frogfs_entry_t *));
+
+    size_t n = frogfs_get_entries(fs, paths->paths, paths->len, found);
+    CHECK(n == paths->len, "%zu of %zu", n, paths->len);
+    for (size_t i = 0; i < paths->len; i++) {
+        CHECK(found[i] == paths->entries[i], "%s", paths->paths[i]);
+    }
+
+    const char *missing[] = { "nope.txt", "sub/nope", "ub/big.txt",
+            "xsub/big.txt", PAD_PATH };
+    n = frogfs_get_entries(fs, missing, 5, found);
+    CHECK(n == 0, "%zu", n);
+
+    free(found);
+}
+
+// Looks up a batch twice, the second time from the lookup cache, which the
+// batch fills for single lookups too.
+static void check_batch_cache(const void *image)
+{
+    frogfs_config_t conf = {
+        .addr = image,
+        .lookup_cache_len = 64,
+    };
+    frogfs_fs_t *fs = frogfs_init(&conf);
+    const char *paths[] = { "index.html", "sub/big.txt", "nope.txt" };
+    const frogfs_entry_t *found[3];
+    frogfs_lookup_stats_t stats;
+
+    frogfs_get_entries(fs, paths, 3, found);
+    size_t n = frogfs_get_entries(fs, paths, 3, found);
+    CHECK(n == 2 && found[0] == frogfs_get_entry(fs, "index.html") &&
+            found[2] == NULL, "%zu", n);
+
+    frogfs_get_lookup_stats(fs, &stats);
+    CHECK(stats.hits == 3 && stats.misses == 4, "%zu hits, %zu misses",
+            stats.hits, stats.misses);
+    frogfs_deinit(fs);
+}
+
+// Looks up a path ending in the name that the image header has when read
+// as a directory entry, which is what a padding slot points at. Matching it
+// would go on to the parent offset, which is the magic.
+static void check_pad_slot(frogfs_fs_t *fs, const uint8_t *image, size_t len)
+{
+    size_t child_count = image[4] | (image[5] << 8);
+    size_t seg_sz = image[6];
+    size_t name_offs = 8 + (4 * child_count);
+    char path[2 + 255];
+
+    if (child_count >= 0xFF00 || name_offs + seg_sz > len) {
+        return;
+    }
+    memcpy(path, "a/", 2);
+    memcpy(path + 2, image + name_offs, seg_sz);
+    CHECK(frogfs_get_entry_hashed(fs, 0xFFFFFFFF, path, 2 + seg_sz) == NULL,
+            "header name");
+}
+
+// Reverses the root's children in a copy of a v1.0 image, whose header can
+// not say whether children are sorted, and looks each of them up.
+static void check_unsorted(const uint8_t *image, size_t len)
+{
+    if (image[5] != 0) {
+        return;
+    }
+
+    uint8_t *copy = malloc(len);
+    memcpy(copy, image, len);
+    size_t num_entries = copy[6] | (copy[7] << 8);
+    uint8_t *root = copy + 12 + (8 * num_entries);
+    size_t child_count = root[4] | (root[5] << 8);
+    uint32_t *children = (uint32_t *) (root + 8);
+    for (size_t i = 0; i < child_count / 2; i++) {
+        uint32_t tmp = children[i];
+        children[i] = children[child_count - 1 - i];
+        children[child_count - 1 - i] = tmp;
+    }
+
+    frogfs_config_t conf = { .addr = copy };
+    frogfs_fs_t *fs = frogfs_init(&conf);
+    CHECK(fs != NULL, "unsorted");
+    for (size_t i = 0; fs && i < child_count; i++) {
+        const frogfs_entry_t *entry = (const void *) (copy + children[i]);
+        size_t name_len;
+        const char *name = frogfs_get_name_view(entry, &name_len);
+        CHECK(frogfs_get_entry_at(fs, NULL, name, name_len) == entry,
+                "unsorted %.*s", (int) name_len, name);
+    }
+    if (fs) {
+        frogfs_deinit(fs);
+    }
+    free(copy);
+}
+
+static void check_fs(frogfs_fs_t *fs, const void *image, size_t len)
+{
+    paths_t paths = {0};
+
+    const frogfs_entry_t *root = frogfs_get_entry(fs, "");
+    CHECK(root != NULL && frogfs_is_dir(root), "root");
+    CHECK(frogfs_get_entry(fs, "/") == root, "/");
+    walk(fs, root, check_entry, &paths);
+    CHECK(paths.len > 1000, "only %zu entries", paths.len);
+
+    check_batch(fs, &paths);
+
+    /* a path hashing to the B-tree padding key must not match a padding
+     * slot, which points at the image header */
+    CHECK(frogfs_get_entry(fs, PAD_PATH) == NULL, PAD_PATH);
+    CHECK(frogfs_get_entry_hashed(fs, 0xFFFFFFFF, PAD_PATH,
+            strlen(PAD_PATH)) == NULL, PAD_PATH);
+    CHECK(frogfs_get_entry_hashed(fs, 0xFFFFFFFF, "index.html", 10) == NULL,
+            "index.html");
+    check_pad_slot(fs, image, len);
+
+    for (size_t i = 0; i < paths.len; i++) {
+        free((void *) paths.paths[i]);
+    }
+    free(paths.paths);
+    free(paths.entries);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s IMAGE\n", argv[0]);
+        return 2;
+    }
+
+    size_t len;
+    void *image = load_file(argv[1], &len);
+
+    for (int cached = 0; cached < 2; cached++) {
+        frogfs_config_t conf = {
+            .addr = image,
+            .lookup_cache_len = cached ? 64 : 0,
+        };
+        frogfs_fs_t *fs = frogfs_init(&conf);
+        CHECK(fs != NULL, "%s", argv[1]);
+        if (fs == NULL) {
+            break;
+        }
+        check_fs(fs, image, len);
+        /* the second pass answers from the cache */
+        check_fs(fs, image, len);
+        frogfs_deinit(fs);
+    }
+
+    check_batch_cache(image);
+    check_unsorted(image, len);
+
+    free(image);
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
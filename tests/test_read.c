@@ -0,0 +1,296 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/* Reads every file of an image and compares it to the file it was built
+ * from:
+ *
+ *     test_read IMAGE FILES_DIR
+ */
+
+#include "common.h"
+
+
+typedef struct {
+    const char *files_dir;
+    uint32_t rng;
+    size_t compressed;
+} ctx_t;
+
+static void check_sequential(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, const uint8_t *data, size_t len, ctx_t *ctx)
+{
+    frogfs_fh_t *fh = frogfs_open(fs, entry, 0);
+    uint8_t *buf = malloc(len + 1);
+    size_t pos = 0;
+    ssize_t n;
+
+    CHECK(fh != NULL, "%s", path);
+    if (fh == NULL) {
+        free(buf);
+        return;
+    }
+    do {
+        size_t chunk = 1 + (xorshift(&ctx->rng) % 8192);
+        if (chunk > len + 1 - pos) {
+            chunk = len + 1 - pos;
+        }
+        n = frogfs_read(fh, buf + pos, chunk);
+        CHECK(n >= 0, "%s at %zu", path, pos);
+        if (n > 0) {
+            pos += n;
+        }
+        CHECK(frogfs_tell(fh) == pos, "%s at %zu", path, pos);
+    } while (n > 0 && pos <= len);
+    CHECK(pos == len && memcmp(buf, data, len) == 0, "%s", path);
+    CHECK(frogfs_read(fh, buf, 1) == 0, "%s", path);
+    frogfs_close(fh);
+    free(buf);
+}
+
+static void check_read_all(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, const uint8_t *data, size_t len, unsigned int flags)
+{
+    frogfs_fh_t *fh = frogfs_open(fs, entry, flags);
+    uint8_t *buf = malloc(len + 1);
+
+    CHECK(fh != NULL, "%s", path);
+    if (fh == NULL) {
+        free(buf);
+        return;
+    }
+    ssize_t n = frogfs_read_all(fh, buf, len + 1);
+    CHECK(n == (ssize_t) len && memcmp(buf, data, len) == 0, "%s: %zd",
+            path, n);
+
+    /* a short buffer gets the start of the file */
+    if (len > 2) {
+        frogfs_seek(fh, 0, SEEK_SET);
+        n = frogfs_read_all(fh, buf, len / 2);
+        CHECK(n == (ssize_t) (len / 2) && memcmp(buf, data, len / 2) == 0,
+                "%s: %zd", path, n);
+    }
+    frogfs_close(fh);
+    free(buf);
+}
+
+// Reads a few bytes at the handle's position and compares them.
+static void check_at(frogfs_fh_t *fh, const char *path, const uint8_t *data,
+        size_t len, size_t pos)
+{
+    uint8_t buf[64];
+    size_t want = len - pos < sizeof(buf) ? len - pos : sizeof(buf);
+
+    CHECK(frogfs_tell(fh) == pos, "%s at %zu", path, pos);
+    ssize_t n = frogfs_read(fh, buf, sizeof(buf));
+    CHECK(n == (ssize_t) want && memcmp(buf, data + pos, want) == 0,
+            "%s at %zu: %zd", path, pos, n);
+}
+
+static void check_seek(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, const uint8_t *data, size_t len, ctx_t *ctx)
+{
+    frogfs_fh_t *fh = frogfs_open(fs, entry, 0);
+    ssize_t pos;
+
+    CHECK(fh != NULL, "%s", path);
+    if (fh == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        size_t to = len ? xorshift(&ctx->rng) % len : 0;
+        pos = frogfs_seek(fh, to, SEEK_SET);
+        CHECK(pos == (ssize_t) to, "%s: SEEK_SET %zu: %zd", path, to, pos);
+        check_at(fh, path, data, len, to);
+
+        /* back and forth from there */
+        long offset = (long) (xorshift(&ctx->rng) % (len + 1)) -
+                (long) frogfs_tell(fh);
+        to = frogfs_tell(fh) + offset;
+        pos = frogfs_seek(fh, offset, SEEK_CUR);
+        CHECK(pos == (ssize_t) to, "%s: SEEK_CUR %ld: %zd", path, offset,
+                pos);
+        check_at(fh, path, data, len, to);
+    }
+
+    long back = len ? xorshift(&ctx->rng) % len : 0;
+    pos = frogfs_seek(fh, -back, SEEK_END);
+    CHECK(pos == (ssize_t) (len - back), "%s: SEEK_END %ld: %zd", path, -back,
+            pos);
+    check_at(fh, path, data, len, len - back);
+
+    /* seeks past either end stop there */
+    pos = frogfs_seek(fh, len + 100, SEEK_SET);
+    CHECK(pos == (ssize_t) len, "%s: SEEK_SET past end: %zd", path, pos);
+    check_at(fh, path, data, len, len);
+
+    frogfs_seek(fh, len / 2, SEEK_SET);
+    pos = frogfs_seek(fh, len, SEEK_CUR);
+    CHECK(pos == (ssize_t) len, "%s: SEEK_CUR past end: %zd", path, pos);
+    check_at(fh, path, data, len, len);
+
+    frogfs_seek(fh, len / 2, SEEK_SET);
+    pos = frogfs_seek(fh, -(long) len - 1, SEEK_CUR);
+    CHECK(pos == 0, "%s: SEEK_CUR before start: %zd", path, pos);
+    check_at(fh, path, data, len, 0);
+
+    pos = frogfs_seek(fh, -(long) len - 1, SEEK_END);
+    CHECK(pos == 0, "%s: SEEK_END before start: %zd", path, pos);
+    CHECK(frogfs_seek(fh, 1, SEEK_END) < 0, "%s: SEEK_END past end", path);
+    CHECK(frogfs_seek(fh, -1, SEEK_SET) < 0, "%s: SEEK_SET negative", path);
+
+    frogfs_close(fh);
+}
+
+static void check_raw(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, const uint8_t *data, size_t len, ctx_t *ctx)
+{
+    frogfs_fh_t *fh = frogfs_open(fs, entry, FROGFS_OPEN_RAW);
+    frogfs_stat_t st;
+    const void *raw;
+
+    CHECK(fh != NULL, "%s", path);
+    if (fh == NULL) {
+        return;
+    }
+    frogfs_stat(fs, entry, &st);
+    size_t raw_sz = frogfs_access(fh, &raw);
+    if (st.compression == FROGFS_COMP_ALGO_NONE) {
+        CHECK(raw_sz == len && memcmp(raw, data, len) == 0, "%s", path);
+    } else {
+        CHECK(raw_sz == st.compressed_sz, "%s", path);
+        ctx->compressed++;
+    }
+
+    size_t pos = 0;
+    ssize_t n;
+    const void *span;
+    while ((n = frogfs_read_span(fh, 1 + (xorshift(&ctx->rng) % 4096),
+            &span)) > 0) {
+        CHECK(span == (const uint8_t *) raw + pos, "%s at %zu", path, pos);
+        pos += n;
+    }
+    CHECK(n == 0 && pos == raw_sz, "%s: %zd at %zu", path, n, pos);
+
+    /* past the end there is nothing left to span */
+    frogfs_seek(fh, raw_sz + 10, SEEK_CUR);
+    CHECK(frogfs_read_span(fh, 16, &span) == 0, "%s", path);
+    frogfs_close(fh);
+}
+
+static void check_file(frogfs_fs_t *fs, const frogfs_entry_t *entry,
+        const char *path, void *arg)
+{
+    ctx_t *ctx = arg;
+    char src[512];
+    size_t len;
+
+    if (!frogfs_is_file(entry)) {
+        return;
+    }
+
+    snprintf(src, sizeof(src), "%s/%s", ctx->files_dir, path);
+    uint8_t *data = load_file(src, &len);
+
+    frogfs_stat_t st;
+    frogfs_stat(fs, entry, &st);
+    CHECK(st.size == len, "%s: %zu != %zu", path, st.size, len);
+
+    check_sequential(fs, entry, path, data, len, ctx);
+    check_read_all(fs, entry, path, data, len, 0);
+    check_read_all(fs, entry, path, data, len, FROGFS_OPEN_WHOLE);
+    check_seek(fs, entry, path, data, len, ctx);
+    check_raw(fs, entry, path, data, len, ctx);
+
+    free(data);
+}
+
+// Reads a compressed file in small chunks, which must not add it to the
+// content cache unless the handle was opened with FROGFS_OPEN_WHOLE.
+static void check_fill(const void *image, const char *path)
+{
+    frogfs_config_t conf = {
+        .addr = image,
+        .content_cache_sz = 4 << 20,
+    };
+    frogfs_fs_t *fs = frogfs_init(&conf);
+    const frogfs_entry_t *entry = frogfs_get_entry(fs, path);
+    frogfs_content_stats_t stats;
+    frogfs_stat_t st;
+    uint8_t buf[4096];
+
+    frogfs_stat(fs, entry, &st);
+    if (st.compression == FROGFS_COMP_ALGO_NONE) {
+        frogfs_deinit(fs);
+        return;
+    }
+
+    for (int whole = 0; whole < 2; whole++) {
+        frogfs_fh_t *fh = frogfs_open(fs, entry,
+                whole ? FROGFS_OPEN_WHOLE : 0);
+        while (frogfs_read(fh, buf, sizeof(buf)) > 0) {
+        }
+        frogfs_close(fh);
+
+        frogfs_get_content_stats(fs, &stats);
+        CHECK(stats.bytes == (whole ? st.size : 0), "%s: %zu cached",
+                path, stats.bytes);
+    }
+    frogfs_deinit(fs);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s IMAGE FILES_DIR\n", argv[0]);
+        return 2;
+    }
+
+    size_t len;
+    void *image = load_file(argv[1], &len);
+
+    const frogfs_config_t confs[] = {
+        { .addr = image },
+        /* pooled decompressors, the content cache and block workers */
+        {
+            .addr = image,
+            .fh_pool_len = 4,
+            .decomp_pool_len = 2,
+            .content_cache_sz = 4 << 20,
+            .worker_threads = 2,
+        },
+    };
+
+    for (size_t i = 0; i < sizeof(confs) / sizeof(confs[0]); i++) {
+        frogfs_fs_t *fs = frogfs_init(&confs[i]);
+        CHECK(fs != NULL, "%s", argv[1]);
+        if (fs == NULL) {
+            break;
+        }
+
+        ctx_t ctx = {
+            .files_dir = argv[2],
+            .rng = 1,
+        };
+        walk(fs, frogfs_get_entry(fs, ""), check_file, &ctx);
+        /* the second pass reads from the cache when there is one */
+        walk(fs, frogfs_get_entry(fs, ""), check_file, &ctx);
+
+        if (confs[i].content_cache_sz && ctx.compressed) {
+            frogfs_content_stats_t stats;
+            frogfs_get_content_stats(fs, &stats);
+            CHECK(stats.hits > 0, "no content cache hits");
+        }
+        frogfs_deinit(fs);
+    }
+
+    check_fill(image, "logs/server.log");
+
+    free(image);
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -13,7 +13,7 @@ def save_array_c(src_path, dst_path, symbol):
             dst_f.write('#include <stdint.h>\n')
             dst_f.write('\n')
             dst_f.write(f'const size_t {symbol}_len = {length};\n')
-            dst_f.write(f'const __attribute__((aligned(4))) uint8_t {symbol}[] = {{\n')
+            dst_f.write(f'const __attribute__((aligned(64))) uint8_t {symbol}[] = {{\n')
             while True:
                 data = src_f.read(12)
                 if not data:
@@ -33,6 +33,7 @@ def save_asm_c(src_path, dst_path, symbol):
         dst_f.write(f'    ".global {symbol}_len\\n"\n')
         dst_f.write(f'    "{symbol}_len:\\n"\n')
         dst_f.write(f'    ".int {length}\\n"\n')
+        dst_f.write('    ".balign 64\\n"\n')
         dst_f.write(f'    ".global {symbol}\\n"\n')
         dst_f.write(f'    "{symbol}:\\n"\n')
         dst_f.write(f'    ".incbin \\"{src_path}\\"\\n"\n')
@@ -3,16 +3,69 @@ from struct import Struct
 # Header
 FROGFS_MAGIC            = 0x474F5246 # FROG
 FROGFS_VER_MAJOR        = 1
-FROGFS_VER_MINOR        = 0
+FROGFS_VER_MINOR        = 1
+
+# Header flags
+FROGFS_HEAD_FLAG_MPH    = 1 << 0
+FROGFS_HEAD_FLAG_HASH64 = 1 << 1
+FROGFS_HEAD_FLAG_BTREE  = 1 << 2
+FROGFS_HEAD_FLAG_BLOOM  = 1 << 3
+FROGFS_HEAD_FLAG_SORTED = 1 << 4
+FROGFS_HEAD_FLAG_DICTS  = 1 << 5
+
+# Deflate compression opts flag for a seek checkpoint index after the data
+FROGFS_COMP_OPT_CKPT    = 1 << 7
+
+# Deflate window size, saved with each seek checkpoint
+FROGFS_CKPT_WINDOW      = 32768
+
+# Number of hashes per B-tree node
+FROGFS_BTREE_B          = 16
+
+# Hash of B-tree padding slots, which no entry may have
+FROGFS_BTREE_PAD        = 0xFFFFFFFF
 
 # FrogFS header
-# magic, bin_sz, num_ent, ver_majr, ver_minor
-head = Struct('<IBBHI')
+# magic, ver_major, ver_minor, num_ent, bin_sz, head_sz, flags, mph_offs,
+# hash_seed, bloom_offs, dict_offs
+head = Struct('<IBBHIHHIIII')
+
+# FrogFS v1.0 header, used when no v1.1 feature is needed
+# magic, ver_major, ver_minor, num_ent, bin_sz
+head_v10 = Struct('<IBBHI')
 
 # Hash table entry
 # hash, offs
 hash = Struct('<II')
 
+# Minimal perfect hash header
+# num_buckets, num_slots
+mph = Struct('<II')
+
+# Bloom filter header
+# num_blocks, num_hashes
+bloom = Struct('<IB3x')
+
+# Dictionary section header
+# num_dicts
+dicts = Struct('<I')
+
+# Dictionary
+# id, offs, len
+dict = Struct('<III')
+
+# Heatshrink seek checkpoint window
+# num_lits, len
+hs_window = Struct('<HH')
+
+# Seek checkpoint index header
+# num_ckpts
+ckpt_head = Struct('<I')
+
+# Seek checkpoint
+# out_offs, in_offs, window_offs
+ckpt = Struct('<III')
+
 # Offset
 # offs
 offs = Struct("<I")
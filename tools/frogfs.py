@@ -18,6 +18,36 @@ def djb2_hash(s: str) -> int:
         hash = ((hash << 5) + hash ^ c) & 0xFFFFFFFF
     return hash
 
+def mph_mix(h: int, seed: int) -> int:
+    '''Integer mixing function used by the minimal perfect hash'''
+    h ^= seed
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xFFFFFFFF
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xFFFFFFFF
+    h ^= h >> 16
+    return h
+
+def _hash64_round(h: int, w: int) -> int:
+    w = (w * 0x87c37b91114253d5) & 0xFFFFFFFFFFFFFFFF
+    w ^= w >> 31
+    h ^= w
+    h = (h * 0x4cf5ad432745937f) & 0xFFFFFFFFFFFFFFFF
+    return h ^ (h >> 29)
+
+def hash64(s: str, seed: int) -> int:
+    '''Seeded 64-bit string hashing algorithm, folded to 32 bits'''
+    data = s.encode('utf-8')
+    h = (seed ^ (len(data) * 0x9e3779b97f4a7c15)) & 0xFFFFFFFFFFFFFFFF
+    for i in range(0, len(data), 8):
+        h = _hash64_round(h, int.from_bytes(data[i:i + 8], 'little'))
+    h ^= h >> 33
+    h = (h * 0xff51afd7ed558ccd) & 0xFFFFFFFFFFFFFFFF
+    h ^= h >> 33
+    h = (h * 0xc4ceb9fe1a85ec53) & 0xFFFFFFFFFFFFFFFF
+    h ^= h >> 33
+    return (h ^ (h >> 32)) & 0xFFFFFFFF
+
 def expand_variables(s, defines={}):
     matches = findall(r'(?<!\\)\$[\w]+|(?<!\\)\$\{[:\w]+\}', s)
     for match in matches:
@@ -1,8 +1,10 @@
 #!/usr/bin/env python
 
 import gzip
+import heapq
 import json
 import os
+import struct
 import zlib
 from argparse import ArgumentParser
 from fnmatch import fnmatch
@@ -18,11 +20,26 @@ try:
 except:
     heatshrink2 = None
 
-from frogfs import align, djb2_hash, expand_variables, pad, pipe_script
+try:
+    import zstandard
+except:
+    zstandard = None
+
+try:
+    import lz4.frame
+except:
+    lz4 = None
+
+from frogfs import (align, djb2_hash, expand_variables, hash64, mph_mix, pad,
+                    pipe_script)
 
 COMP_ALGO_ZLIB = 1
 COMP_ALGO_HEATSHRINK = 2
 COMP_ALGO_GZIP = 3
+COMP_ALGO_BLOCK = 4
+COMP_ALGO_ZSTD = 5
+COMP_ALGO_LZ4 = 6
+COMP_ALGO_HEATSHRINK_CKPT = 7
 
 
 def load_config() -> dict:
@@ -30,7 +47,7 @@ def load_config() -> dict:
     with open(config_file, 'r') as f:
         doc = yaml.safe_load(f)
 
-    config = {'define': {}, 'collect': {}, 'filter': []}
+    config = {'define': {}, 'collect': {}, 'filter': [], 'options': {}}
 
     def add_define(name, value):
         value = expand_variables(value, config['define'])
@@ -93,6 +110,12 @@ def load_config() -> dict:
     else:
         raise Exception('unexpected type for filter')
 
+    options = doc.get('options', {})
+    if isinstance(options, dict):
+        config['options'].update(options)
+    else:
+        raise Exception('unexpected type for options')
+
     return config
 
 def collect_entries() -> dict:
@@ -230,6 +253,8 @@ def load_state() -> None:
         if ent['type'] == 'file':
             ent['compress'] = state.get('compress')
             ent['real_size'] = state.get('real_size')
+            ent['comp_size'] = state.get('comp_size')
+            ent['dictionary'] = state.get('dictionary')
             ent['transform'] = state.get('transform', {})
 
 def filter_rank(filter) -> int:
@@ -289,9 +314,13 @@ def apply_rules() -> None:
                         compress = None
                         continue
 
-                    compressors = ['deflate', 'gzip', 'zlib']
+                    compressors = ['block', 'deflate', 'gzip', 'zlib']
                     if heatshrink2:
                         compressors += ['heatshrink']
+                    if zstandard:
+                        compressors += ['zstd']
+                    if lz4:
+                        compressors += ['lz4']
                     if parts[1] in compressors:
                         compress = [parts[1], args]
                         continue
@@ -321,6 +350,163 @@ def apply_rules() -> None:
                 ent['compress'] = compress
                 ent['skip'] = False
 
+def deflate_checkpointed(data: bytes, level: int, wbits: int,
+                         spacing: int) -> tuple:
+    '''Deflate data with a sync flush every spacing bytes, returning the
+    compressed data and a seek checkpoint index'''
+    compressor = zlib.compressobj(level, zlib.DEFLATED, wbits)
+    compressed = bytearray()
+    ckpts = []
+
+    # a sync flush ends the block on a byte boundary without resetting the
+    # dictionary, so inflate can resume there given the preceding window
+    start = 0
+    for pos in range(spacing, len(data), spacing):
+        compressed += compressor.compress(data[start:pos])
+        compressed += compressor.flush(zlib.Z_SYNC_FLUSH)
+        ckpts.append((pos, len(compressed)))
+        start = pos
+    compressed += compressor.compress(data[start:])
+    compressed += compressor.flush()
+
+    index = bytearray(format.ckpt_head.pack(len(ckpts)))
+    windows = bytearray()
+    window_offs = format.ckpt_head.size + format.ckpt.size * len(ckpts)
+    for out_offs, in_offs in ckpts:
+        index += format.ckpt.pack(out_offs, in_offs, window_offs + len(windows))
+        windows += data[max(0, out_offs - format.FROGFS_CKPT_WINDOW):out_offs]
+
+    return bytes(compressed), bytes(index + windows)
+
+def heatshrink_checkpointed(compressed: bytes, data: bytes, window: int,
+                            lookahead: int, spacing: int) -> bytes:
+    '''Walk a heatshrink stream and return a seek checkpoint index with a
+    checkpoint at the first symbol after every spacing bytes'''
+    padded = compressed + b'\0\0\0'
+    bit = 0
+
+    def get_bits(count: int) -> int:
+        nonlocal bit
+        word = int.from_bytes(padded[bit >> 3:(bit >> 3) + 3], 'big')
+        value = (word >> (24 - (bit & 7) - count)) & ((1 << count) - 1)
+        bit += count
+        return value
+
+    ckpts = []
+    out = 0
+    next_ckpt = spacing
+    while out < len(data):
+        if out >= next_ckpt:
+            ckpts.append((out, bit))
+            next_ckpt = out + spacing
+        if get_bits(1):
+            get_bits(8)
+            out += 1
+        else:
+            get_bits(window)
+            out += get_bits(lookahead) + 1
+
+    index = bytearray(format.ckpt_head.pack(len(ckpts)))
+    windows = bytearray()
+    window_offs = format.ckpt_head.size + format.ckpt.size * len(ckpts)
+    for out_offs, bit in ckpts:
+        # rebuild the window as literals, with the remaining bits of the
+        # current byte after them, and pick the literal count so the whole
+        # bitstream fills a whole number of bytes
+        tail = -bit & 7
+        num_lits = (1 << window) + (-tail & 7)
+        history = data[max(0, out_offs - num_lits):out_offs]
+        history = bytes(num_lits - len(history)) + history
+
+        value = 0
+        for c in history:
+            value = (value << 9) | 0x100 | c
+        value = (value << tail) | (compressed[bit >> 3] & ((1 << tail) - 1))
+        bits = value.to_bytes((num_lits * 9 + tail) // 8, 'big')
+
+        index += format.ckpt.pack(out_offs, (bit + 7) >> 3,
+                                  window_offs + len(windows))
+        windows += format.hs_window.pack(num_lits, len(bits)) + bits
+
+    return bytes(index + windows)
+
+def train_dictionary(samples: list, size: int) -> bytes:
+    '''Build a deflate preset dictionary from the segments whose substrings
+    are shared by the most samples'''
+    gram_len, seg_len, seg_step = 8, 64, 16
+    samples = [sample[:0x10000] for sample in samples]
+
+    def grams(data: bytes) -> set:
+        return {data[i:i + gram_len] for i in range(len(data) - gram_len + 1)}
+
+    # count the samples each substring appears in
+    counts = {}
+    for sample in samples:
+        for gram in grams(sample):
+            counts[gram] = counts.get(gram, 0) + 1
+
+    def score(segment: bytes, covered: set) -> int:
+        return sum(counts[gram] - 1 for gram in grams(segment) - covered)
+
+    heap = []
+    for sample in samples:
+        for start in range(0, max(1, len(sample) - seg_len + 1), seg_step):
+            segment = sample[start:start + seg_len]
+            value = score(segment, set())
+            if value:
+                heap.append((-value, len(heap), segment))
+    heapq.heapify(heap)
+
+    # lazy greedy selection, rescoring segments against what is covered
+    covered = set()
+    chosen = []
+    total = 0
+    while heap and total < size:
+        _, n, segment = heapq.heappop(heap)
+        value = score(segment, covered)
+        if not value:
+            continue
+        if heap and value < -heap[0][0]:
+            heapq.heappush(heap, (-value, n, segment))
+            continue
+        chosen.append(segment)
+        covered |= grams(segment)
+        total += len(segment)
+
+    # the most useful segments go last, closest to the data
+    return b''.join(reversed(chosen))[-size:]
+
+def deflate_blocks(data: bytes, level: int, block_size: int) -> bytes:
+    '''Deflate data in independent blocks behind a block offset table'''
+    blocks = []
+    for start in range(0, len(data), block_size):
+        block = data[start:start + block_size]
+        compressor = zlib.compressobj(level, zlib.DEFLATED, -zlib.MAX_WBITS)
+        compressed = compressor.compress(block) + compressor.flush()
+        # blocks that do not shrink are stored, the runtime tells them apart
+        # by their length
+        blocks.append(compressed if len(compressed) < len(block) else block)
+
+    offs = [4 * (len(blocks) + 1)]
+    for block in blocks:
+        offs.append(offs[-1] + len(block))
+
+    return struct.pack(f'<{len(offs)}I', *offs) + b''.join(blocks)
+
+def lz4_block_size(args: dict) -> int:
+    '''Returns the LZ4 frame block size id for a block-size argument'''
+    ids = {
+        65536: lz4.frame.BLOCKSIZE_MAX64KB,
+        262144: lz4.frame.BLOCKSIZE_MAX256KB,
+        1048576: lz4.frame.BLOCKSIZE_MAX1MB,
+        4194304: lz4.frame.BLOCKSIZE_MAX4MB,
+    }
+    block_size = args.get('block-size', 65536)
+    if block_size not in ids:
+        raise Exception('lz4 block-size must be one of 65536, 262144, '
+                        '1048576 or 4194304')
+    return ids[block_size]
+
 def preprocess(ent: dict) -> None:
     '''Run preprocessors for a given entry'''
     global dirty
@@ -363,17 +549,62 @@ def preprocess(ent: dict) -> None:
                 print(f'           - compress {name}... ', file=stderr, end='',
                         flush=True)
 
+            index = None
+            spacing = args.get('checkpoint')
+            if args.get('dictionary'):
+                if name != 'zlib' or spacing:
+                    raise Exception('dictionary requires compress zlib '
+                                    'without checkpoint')
+                # compressed once every file of the group is transformed
+                ent['pending'] = data
+                print('deferred', file=stderr)
+                dirty |= True
+                return
+
             if name == 'zlib':
                 level = args.get('level', 9)
-                compressed = zlib.compress(data, level)
+                if spacing:
+                    compressed, index = deflate_checkpointed(data, level,
+                            zlib.MAX_WBITS, spacing)
+                else:
+                    compressed = zlib.compress(data, level)
             elif heatshrink2 and name == 'heatshrink':
                 window = args.get('window', 11)
                 lookahead = args.get('lookahead', 4)
                 compressed = heatshrink2.compress(data, window, lookahead)
+                if spacing:
+                    index = heatshrink_checkpointed(compressed, data, window,
+                            lookahead, spacing)
+            elif name == 'block':
+                level = args.get('level', 9)
+                block_size = args.get('block-size', 65536)
+                if block_size & (block_size - 1) or \
+                        not 512 <= block_size <= 1 << 24:
+                    raise Exception('block-size must be a power of two '
+                                    'between 512 and 16M')
+                compressed = deflate_blocks(data, level, block_size)
             elif name == 'gzip':
                 level = args.get('level', 9)
-                compressed = gzip.compress(data, level)
-
+                if spacing:
+                    compressed, index = deflate_checkpointed(data, level,
+                            zlib.MAX_WBITS | 16, spacing)
+                else:
+                    compressed = gzip.compress(data, level)
+            elif zstandard and name == 'zstd':
+                level = args.get('level', 19)
+                compressor = zstandard.ZstdCompressor(level=level,
+                        write_checksum=False, write_content_size=True)
+                compressed = compressor.compress(data)
+            elif lz4 and name == 'lz4':
+                # acceleration trades ratio for compression speed, below the
+                # default level 0
+                level = -args['acceleration'] if 'acceleration' in args \
+                        else args.get('level', 12)
+                compressed = lz4.frame.compress(data, compression_level=level,
+                        block_size=lz4_block_size(args))
+
+            ent['comp_size'] = None
+            ent['dictionary'] = None
             if len(data) < len(compressed):
                 print('skipped', file=stderr)
                 ent['real_size'] = None
@@ -385,6 +616,10 @@ def preprocess(ent: dict) -> None:
                 print(f'done ({percent * 100:.1f}%)', file=stderr)
                 ent['real_size'] = len(data)
                 data = compressed
+                if index:
+                    # the index follows the aligned compressed data
+                    ent['comp_size'] = len(data)
+                    data = pad(data) + index
 
         with open(os.path.join(cache_dir, dest), 'wb') as f:
             f.write(data)
@@ -417,6 +652,15 @@ def run_preprocessors() -> None:
             if root_mtime > cache_mtime:
                 ent['skip'] = False
 
+    # a dictionary depends on every file of its group
+    for group in dictionary_groups().values():
+        if not all(ent['skip'] for ent in group):
+            for ent in group:
+                ent['skip'] = False
+
+    for ent in entries.values():
+        dest = ent['dest']
+
         # if entry is not marked skip, preprocess
         if not ent['skip']:
             preprocess(ent)
@@ -425,6 +669,67 @@ def run_preprocessors() -> None:
         if dest in discards.keys() and not ent.get('discard'):
             dirty |= True
 
+    compress_with_dictionaries()
+
+def dictionary_groups() -> dict:
+    '''Group files compressed with a shared dictionary by compress args'''
+    groups = {}
+    for ent in entries.values():
+        if ent['type'] != 'file' or not ent.get('compress'):
+            continue
+        if not ent['compress'][1].get('dictionary'):
+            continue
+        key = json.dumps(ent['compress'], sort_keys=True)
+        groups.setdefault(key, []).append(ent)
+    return groups
+
+def compress_with_dictionaries() -> None:
+    '''Build a dictionary for each group and compress its deferred files'''
+    for group in dictionary_groups().values():
+        group = [ent for ent in group if 'pending' in ent]
+        if not group:
+            continue
+
+        _, args = group[0]['compress']
+        level = args.get('level', 9)
+        dictionary = args['dictionary']
+        if isinstance(dictionary, str):
+            path = expand_variables(dictionary, config['define'])
+            with open(path, 'rb') as f:
+                dictionary = f.read()[-format.FROGFS_CKPT_WINDOW:]
+        else:
+            dictionary = train_dictionary([ent['pending'] for ent in group],
+                    min(int(dictionary), format.FROGFS_CKPT_WINDOW))
+
+        dict_id = zlib.adler32(dictionary) if dictionary else None
+        if dict_id is not None:
+            os.makedirs(dict_dir, exist_ok=True)
+            with open(os.path.join(dict_dir, f'{dict_id:08x}.bin'), 'wb') as f:
+                f.write(dictionary)
+        print(f'         - Dictionary: {len(dictionary)} bytes for '
+              f'{len(group)} files', file=stderr)
+
+        for ent in group:
+            data = ent.pop('pending')
+            if dictionary:
+                compressor = zlib.compressobj(level, zlib.DEFLATED,
+                        zlib.MAX_WBITS, zdict=dictionary)
+                compressed = compressor.compress(data) + compressor.flush()
+            else:
+                compressed = zlib.compress(data, level)
+
+            ent['comp_size'] = None
+            if len(data) < len(compressed):
+                ent['real_size'] = None
+                ent['dictionary'] = None
+            else:
+                ent['real_size'] = len(data)
+                ent['dictionary'] = dict_id
+                data = compressed
+
+            with open(os.path.join(cache_dir, ent['dest']), 'wb') as f:
+                f.write(data)
+
 def check_output() -> None:
     '''Checks if the output file exists or is older than the state file'''
     global dirty
@@ -469,6 +774,10 @@ def save_state() -> None:
                     state['compress'] = ent['compress']
                 if ent.get('real_size') is not None:
                     state['real_size'] = ent['real_size']
+                if ent.get('comp_size') is not None:
+                    state['comp_size'] = ent['comp_size']
+                if ent.get('dictionary') is not None:
+                    state['dictionary'] = ent['dictionary']
         paths[dest] = state
 
     for ent in tuple(entries.values()):
@@ -487,7 +796,8 @@ def generate_file_header(ent) -> None:
     '''Generate header and load data for a file entry'''
     name = ent['name'].encode('utf-8')
 
-    data_size = os.path.getsize(os.path.join(cache_dir, ent['dest']))
+    file_size = os.path.getsize(os.path.join(cache_dir, ent['dest']))
+    data_size = file_size
     if ent.get('compress') and ent.get('real_size') is not None:
         method, args = ent['compress']
         if method in ('deflate', 'zlib'):
@@ -501,6 +811,23 @@ def generate_file_header(ent) -> None:
         elif method == 'gzip':
             comp = COMP_ALGO_GZIP
             opts = args.get('level', 9)
+        elif method == 'block':
+            comp = COMP_ALGO_BLOCK
+            opts = args.get('block-size', 65536).bit_length() - 1
+        elif zstandard and method == 'zstd':
+            comp = COMP_ALGO_ZSTD
+            opts = args.get('level', 19)
+        elif lz4 and method == 'lz4':
+            comp = COMP_ALGO_LZ4
+            opts = lz4_block_size(args)
+
+        if ent.get('comp_size') is not None:
+            if comp == COMP_ALGO_HEATSHRINK:
+                # every heatshrink opts bit is taken, so use its own id
+                comp = COMP_ALGO_HEATSHRINK_CKPT
+            else:
+                opts |= format.FROGFS_COMP_OPT_CKPT
+            data_size = ent['comp_size']
 
         header = bytearray(format.comp.size + len(name))
         format.comp.pack_into(header, 0, 0, 0xFF00 | comp, len(name), opts, 0,
@@ -512,7 +839,7 @@ def generate_file_header(ent) -> None:
         header[format.file.size:] = name
 
     ent['header'] = header
-    ent['data_size'] = data_size
+    ent['data_size'] = file_size
 
 def generate_dir_header(dirent: dict) -> None:
     '''Generate header and data for a directory entry'''
@@ -534,8 +861,13 @@ def generate_dir_header(dirent: dict) -> None:
             if ent['dest']:
                 ent['parent'] = dirent
 
+    # sorted by name so the runtime can binary search children
+    children.sort(key=lambda ent: ent['name'].encode('utf-8'))
     dirent['children'] = children
     child_count = len(children)
+    if child_count >= 0xFF00:
+        raise Exception(f'"/{dirent["dest"]}" has {child_count} entries, '
+                        'a directory can have at most 65279')
 
     header = bytearray(format.dir.size + (4 * child_count) + len(seg))
     format.dir.pack_into(header, 0, 0, child_count, len(seg), 0)
@@ -551,13 +883,212 @@ def generate_entry_headers() -> None:
         elif ent['type'] == 'dir':
             generate_dir_header(ent)
 
+def generate_hashtable() -> None:
+    '''Generate sorted list of hashes for entries'''
+    global hash_seed, hashtable
+
+    if len(entries) > 0xFFFF:
+        raise Exception(f'{len(entries)} entries, the format supports at '
+                        'most 65535')
+
+    hashtable = [(djb2_hash(ent['dest']), ent) for ent in entries.values()]
+    collisions = len(hashtable) - len({hash for hash, _ in hashtable})
+
+    if config['options'].get('hash64'):
+        # find a seed that gives every path a unique hash, which also must
+        # not collide with the B-tree padding key
+        for hash_seed in range(0x10000):
+            hashtable = [(hash64(ent['dest'], hash_seed), ent)
+                         for ent in entries.values()]
+            hashes = {hash for hash, _ in hashtable}
+            if len(hashes) == len(hashtable) and \
+                    format.FROGFS_BTREE_PAD not in hashes:
+                break
+        else:
+            raise Exception('unable to find a collision free hash seed')
+
+        print(f'         - Hash64 seed {hash_seed}, djb2 would have had '
+              f'{collisions} collisions', file=stderr)
+    elif collisions:
+        print(f'         - Hash table has {collisions} djb2 collisions',
+              file=stderr)
+
+    hashtable.sort(key=lambda e: e[0])
+
+def generate_btree() -> None:
+    '''Reorder the hashtable into an implicit B-tree layout'''
+    global hashtable
+
+    if not config['options'].get('hash-btree'):
+        return
+
+    if not config['options'].get('hash64'):
+        raise Exception('hash-btree requires the hash64 option')
+
+    B = format.FROGFS_BTREE_B
+    num_nodes = (len(hashtable) + B - 1) // B
+    padding = (format.FROGFS_BTREE_PAD, None)
+    layout = [padding] * (num_nodes * B)
+    sorted_hashes = iter(hashtable)
+
+    # node k has child k * (B + 1) + i + 1 before its i-th key
+    def fill(k: int) -> None:
+        if k >= num_nodes:
+            return
+        for i in range(B):
+            fill(k * (B + 1) + i + 1)
+            layout[k * B + i] = next(sorted_hashes, padding)
+        fill(k * (B + 1) + B + 1)
+
+    fill(0)
+    hashtable = layout
+
+def generate_mph() -> None:
+    '''Generate minimal perfect hash section for the hashtable'''
+    if not config['options'].get('perfect-hash'):
+        return
+
+    # slots are 16-bit hashtable indexes, which the entry limit checked in
+    # generate_hashtable keeps in range even with B-tree padding
+    assert len(hashtable) <= 0x10000
+
+    # map each distinct hash to its first hashtable index
+    first = {}
+    for i, (hash, ent) in enumerate(hashtable):
+        if ent is not None:
+            first.setdefault(hash, i)
+
+    num_slots = len(first)
+    num_buckets = (num_slots + 3) // 4
+    while True:
+        buckets = [[] for _ in range(num_buckets)]
+        for hash in first.keys():
+            buckets[mph_mix(hash, 0) % num_buckets].append(hash)
+        order = sorted(range(num_buckets), key=lambda b: -len(buckets[b]))
+
+        disp = [0] * num_buckets
+        slots = [None] * num_slots
+        placed = True
+        for b in order:
+            bucket = buckets[b]
+            if len(bucket) < 2:
+                break
+
+            # search for a seed that places the whole bucket in free slots
+            for seed in range(1, 0x10000):
+                positions = [mph_mix(hash, seed) % num_slots for hash in bucket]
+                if len(set(positions)) == len(bucket) and \
+                        all(slots[pos] is None for pos in positions):
+                    break
+            else:
+                placed = False
+                break
+
+            disp[b] = seed
+            for hash, pos in zip(bucket, positions):
+                slots[pos] = first[hash]
+
+        if placed:
+            break
+        num_buckets *= 2
+
+    # single entry buckets are placed directly into the remaining slots
+    free = (i for i, slot in enumerate(slots) if slot is None)
+    for b in order:
+        if len(buckets[b]) != 1:
+            continue
+        pos = next(free)
+        disp[b] = 0x80000000 | pos
+        slots[pos] = first[buckets[b][0]]
+
+    section = bytearray(format.mph.pack(num_buckets, num_slots))
+    section += struct.pack(f'<{num_buckets}I', *disp)
+    section += struct.pack(f'<{num_slots}H', *slots)
+    sections['mph'] = section
+
+    print(f'         - Perfect hash: {num_slots} slots, {num_buckets} buckets',
+          file=stderr)
+
+def generate_bloom() -> None:
+    '''Generate bloom filter section for the hashtable'''
+    bits_per_entry = config['options'].get('bloom-filter')
+    if not bits_per_entry:
+        return
+
+    hashes = {hash for hash, ent in hashtable if ent is not None}
+    num_blocks = (len(hashes) * bits_per_entry + 511) // 512
+    num_hashes = max(1, min(16, round(bits_per_entry * 0.69)))
+
+    words = [0] * (num_blocks * 16)
+    for hash in hashes:
+        block = (mph_mix(hash, 1) % num_blocks) * 16
+        x = mph_mix(hash, 2)
+        a = x & 0xFFFF
+        b = (x >> 16) | 1
+        for i in range(num_hashes):
+            bit = (a + i * b) & 511
+            words[block + (bit >> 5)] |= 1 << (bit & 31)
+
+    section = bytearray(format.bloom.pack(num_blocks, num_hashes))
+    section += struct.pack(f'<{len(words)}I', *words)
+    sections['bloom'] = section
+
+    print(f'         - Bloom filter: {num_blocks * 64} bytes, {num_hashes} '
+          'hashes', file=stderr)
+
+def generate_dictionaries() -> None:
+    '''Generate the section of dictionaries used by compressed files'''
+    ids = sorted({ent['dictionary'] for ent in entries.values()
+                  if ent['type'] == 'file' and ent.get('compress') and
+                  ent.get('real_size') is not None and ent.get('dictionary')})
+    if not ids:
+        return
+
+    dictionaries = []
+    for dict_id in ids:
+        with open(os.path.join(dict_dir, f'{dict_id:08x}.bin'), 'rb') as f:
+            dictionaries.append(f.read())
+
+    offs = align(format.dicts.size + format.dict.size * len(ids))
+    section = bytearray(format.dicts.pack(len(ids)))
+    for dict_id, dictionary in zip(ids, dictionaries):
+        section += format.dict.pack(dict_id, offs, len(dictionary))
+        offs += align(len(dictionary))
+    for dictionary in dictionaries:
+        section = pad(section) + dictionary
+    sections['dicts'] = section
+
 def append_frogfs_header() -> None:
-    '''Generate FrogFS header and calculate entry offsets'''
+    '''Generate FrogFS header and calculate entry and section offsets'''
     global data
 
     num_ent = len(entries)
 
-    bin_size = align(format.head.size) + align(format.hash.size * num_ent)
+    flags = 0
+    if 'mph' in sections:
+        flags |= format.FROGFS_HEAD_FLAG_MPH
+    if config['options'].get('hash64'):
+        flags |= format.FROGFS_HEAD_FLAG_HASH64
+    if config['options'].get('hash-btree'):
+        flags |= format.FROGFS_HEAD_FLAG_BTREE
+    if 'bloom' in sections:
+        flags |= format.FROGFS_HEAD_FLAG_BLOOM
+    flags |= format.FROGFS_HEAD_FLAG_SORTED
+    if 'dicts' in sections:
+        flags |= format.FROGFS_HEAD_FLAG_DICTS
+
+    # v1.0 readers only check the major version and expect the hashtable
+    # right after the short header, so keep that layout unless the image
+    # needs something they cannot read. Sorted children are only a lookup
+    # hint and are dropped with the flags.
+    compat = not flags & ~format.FROGFS_HEAD_FLAG_SORTED
+
+    head_size = align(format.head_v10.size if compat else format.head.size)
+    if config['options'].get('hash-btree'):
+        # start B-tree nodes on a cache line
+        head_size = (head_size + 63) // 64 * 64
+
+    bin_size = head_size + align(format.hash.size * len(hashtable))
     for ent in entries.values():
         ent['header_offs'] = bin_size
         bin_size += align(len(ent['header']))
@@ -566,10 +1097,25 @@ def append_frogfs_header() -> None:
         ent['data_offs'] = bin_size
         bin_size += align(ent['data_size'])
 
+    section_offs = {}
+    for name, section in sections.items():
+        section_offs[name] = bin_size
+        bin_size += align(len(section))
+
     bin_size += format.foot.size
 
+    if compat:
+        data += format.head_v10.pack(format.FROGFS_MAGIC,
+                                     format.FROGFS_VER_MAJOR, 0, num_ent,
+                                     bin_size)
+        return
+
     data += format.head.pack(format.FROGFS_MAGIC, format.FROGFS_VER_MAJOR,
-                             format.FROGFS_VER_MINOR, num_ent, bin_size)
+                             format.FROGFS_VER_MINOR, num_ent, bin_size,
+                             head_size, flags, section_offs.get('mph', 0),
+                             hash_seed, section_offs.get('bloom', 0),
+                             section_offs.get('dicts', 0)
+                             ).ljust(head_size, b'\0')
 
 def apply_fixups() -> None:
     '''Insert offsets in dir and file headers'''
@@ -586,13 +1132,17 @@ def apply_fixups() -> None:
                                   offs)
 
 def append_hashtable() -> None:
-    '''Generate hashtable for entries'''
+    '''Append hashtable for entries'''
     global data
 
-    hashed_entries = {djb2_hash(v['dest']): v for k,v in entries.items()}
-    hashed_entries = dict(sorted(hashed_entries.items(), key=lambda e: e))
+    if config['options'].get('hash-btree'):
+        for hash, _ in hashtable:
+            data += format.offs.pack(hash)
+        for _, ent in hashtable:
+            data += format.offs.pack(ent['header_offs'] if ent else 0)
+        return
 
-    for hash, ent in hashed_entries.items():
+    for hash, ent in hashtable:
         data += format.hash.pack(hash, ent['header_offs'])
 
 def append_headers_and_files() -> None:
@@ -608,6 +1158,13 @@ def append_headers_and_files() -> None:
             with open(os.path.join(cache_dir, ent['dest']), 'rb') as f:
                 data += pad(f.read())
 
+def append_sections() -> None:
+    '''Append optional sections'''
+    global data
+
+    for section in sections.values():
+        data += pad(section)
+
 def append_footer() -> None:
     '''Generate FrogFS footer'''
     global data
@@ -651,6 +1208,7 @@ if __name__ == '__main__':
     output_name, _ = os.path.splitext(os.path.basename(output_file))
     cache_dir = os.path.join(build_dir, output_name + '-cache')
     state_file = os.path.join(build_dir, output_name + '-cache-state.json')
+    dict_dir = os.path.join(build_dir, output_name + '-dicts')
 
     # setup environment
     os.environ['FROGFS_DIR'] = frogfs_dir
@@ -665,6 +1223,9 @@ if __name__ == '__main__':
     discards = {}
     dirty = False
     data = b''
+    hash_seed = 0
+    hashtable = []
+    sections = {}
 
     # Stage 1
     print("       - Stage 1", file=stderr)
@@ -678,9 +1239,15 @@ if __name__ == '__main__':
     print("       - Stage 2", file=stderr)
     save_state()
     generate_entry_headers()
+    generate_hashtable()
+    generate_btree()
+    generate_mph()
+    generate_bloom()
+    generate_dictionaries()
     append_frogfs_header()
     append_hashtable()
     apply_fixups()
     append_headers_and_files()
+    append_sections()
     append_footer()
     write_output()